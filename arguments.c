@@ -22,19 +22,41 @@
  * GNU LPGL 3.0
  */
 #include <stdlib.h>
+#include <limits.h>
 #include <libgen.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <getopt.h>
 #include "multinom.h"
 
 #define SPACE ' '
 
-char *argstr = NULL;
+THREAD_LOCAL char *argstr = NULL;
+bool EVAL_MODE = false;
+bool EVAL_CHECK = false;
+char *BOUNDS_ARG = NULL;
+int TOP_K = 0;
+bool GRAY_ORDER = false;
+bool ESTIMATE_MODE = false;
+out_format OUT_FORMAT = FMT_TEXT;
+term_order TERM_ORDER = ORD_LEX;
+long TERM_ROW = -1;
+char *INDEX_ARG = NULL;
+int SHARD = 0;
+int NR_SHARDS = 1;
+bool RANGE_MODE = false;
+double MAX_MEMORY = 0.0;
+bool APPROX_MODE = false;
+bool APPROX_PROB = false;
+bool STATS_MODE = false;
+bool BATCH_MODE = false;
+int NR_JOBS = 0;
+
 void show_usage( char *prog_name)
 {
-  fprintf( stderr, "Usage: \"%s [-h|-p] (multinomial expression)^power.\"\n", basename(prog_name));
+  fprintf( stderr, "Usage: \"%s [-h|-p|-e|-c|-g] [-b bounds] [--top K] [-f format] [--order O] [--estimate] [--term ROW|--index POWERS] [--shard i/N] [--range] [--max-memory SIZE] [--approx|--prob] [--stats] [--batch [-j N]] (multinomial expression)^power.\"\n", basename(prog_name));
 }
 void show_help(void )
 {
@@ -42,8 +64,89 @@ void show_help(void )
   fprintf(stderr, " -p -- No helpful text, or arrows pointing at syntax error.\n"
                   "       Intended for piping the expression into another filter or calc.\n"
                     );
+  fprintf(stderr, " -e -- Evaluates the expansion at points read from standard input, one\n"
+                  "       point per line, with a number for each variable, in the order\n"
+                  "       they are in the expression. Prints one value per line.\n"
+                  " -c -- Like -e, but also checks every value against the value of the\n"
+                  "       expression before it was expanded.\n"
+                    );
+  fprintf(stderr, " -b -- Truncates the expansion to the terms where the variables\n"
+                  "       doesn't have a higher power than their bounds: \"-b x=2,y=3\"\n"
+                  "       leaves only terms with at most x^2 and y^3, \"-b 2\" bounds\n"
+                  "       every variable to the power of 2.\n"
+                    );
+  fprintf(stderr, " -t, --top K -- Prints only the K terms with the largest absolute\n"
+                  "       coeffecients, biggest first, without expanding everything.\n"
+                    );
+  fprintf(stderr, " -g, --gray -- Prints the terms in an order where the powers of one\n"
+                  "       variable goes to another from one term to the next. Faster,\n"
+                  "       when the order of the terms doesn't matter.\n"
+                    );
+  fprintf(stderr, " -f, --format F -- Writes the terms as text, like \"x^2 + 2xy + y^2\", the\n"
+                  "       default, or as jsonl, one object per line with the coeffecient\n"
+                  "       and the powers, csv, with a column for every variable, and\n"
+                  "       the coeffecient last, or latex.\n"
+                    );
+  fprintf(stderr, " --order O -- The order of the terms: lex, the default, with the highest\n"
+                  "       powers of the first variables first, grlex, the highest degree\n"
+                  "       first, then lex, revlex, with the highest powers of the last\n"
+                  "       variables first, or grevlex, the highest degree first, then the\n"
+                  "       lowest powers of the last variables first.\n"
+                    );
+  fprintf(stderr, " --estimate -- Doesn't expand, but prints the number of terms, about how\n"
+                  "       many bytes they take to print, the bits of the biggest\n"
+                  "       coeffecient, and the memory needed for expanding, with -e,\n"
+                  "       --top and -g.\n"
+                    );
+  fprintf(stderr, " --term ROW -- Prints just the term in the row ROW of the expansion,\n"
+                  "       counting from 0, in the order they are printed, without\n"
+                  "       expanding the rest.\n"
+                  " --index POWERS -- Prints the row of the term with the POWERS, like\n"
+                  "       \"x=2,y=3\", a variable that isn't there has the power 0.\n"
+                    );
+  fprintf(stderr, " --shard i/N -- Prints just the i-th of N even slices of the terms,\n"
+                  "       i from 1 to N, the slices after each other are the whole\n"
+                  "       expansion, so N processes can expand one slice each.\n"
+                    );
+  fprintf(stderr, " --range -- Prints the expansions of all the powers from 1 to n, one\n"
+                  "       after another, every one made from the one before.\n"
+                    );
+  fprintf(stderr, " --max-memory SIZE -- The memory the expansion may use, like 512M or\n"
+                  "       2G, a terms table that doesn't fit is made and expanded a\n"
+                  "       chunk at the time, and the output of the workers is spooled\n"
+                  "       to temporary files, if it has to. --estimate tells the plan.\n"
+                    );
+  fprintf(stderr, " --approx -- Prints the coeffecients with 10 digits, like 1.234567890e+4321,\n"
+                  "       made from their logarithms in doubles, as fast for any exponent,\n"
+                  "       instead of computing them exactly. In the text, a space keeps\n"
+                  "       the coeffecient apart from the variables, like 1.2e+1 ab^2.\n"
+                  " --prob -- Like --approx, but divided by (|c1| + |c2| + ...)^n, so\n"
+                  "       they add up to 1, like the probabilities of a multinomial\n"
+                  "       distribution, when the coeffecients are.\n"
+                    );
+  fprintf(stderr, " --stats -- Doesn't print the terms, but how many there are, how many are\n"
+                  "       negative or 0, the sum of the coeffecients, checked against\n"
+                  "       (c1 + c2 + ...)^n without -b, the biggest and smallest of them,\n"
+                  "       and how many coeffecients there are of every number of bits,\n"
+                  "       of their integer parts, when they have decimals.\n"
+                    );
+  fprintf(stderr, " --batch -- Reads one expression per line from standard input, instead\n"
+                  "       of from the command line, and expands them in worker threads.\n"
+                  "       The expansions are written in the order of the lines, a line\n"
+                  "       with an error is reported with its number, and skipped.\n"
+                  " -j, --jobs N -- The number of worker threads of --batch, and of the\n"
+                  "       expansion of a big expression, the default is one per cpu.\n"
+                    );
+  fprintf(stderr, "\n The long options: --help, --preprocess, --eval, --check and --bounds\n"
+                  " are the same as -h, -p, -e, -c and -b.\n"
+                    );
   fprintf(stderr, "\n A multinomial expression is on the form: \"(a - 2b + c)^4\"\n"
-                   " parentheses are mandatory, as is spaces between operands and operators.\n\n"
+                   " parentheses are mandatory, as is spaces between operands and operators.\n"
+                   " Coeffecients may have decimals, like in \"(0.25x - 1.5y)^8\", they are\n"
+                   " expanded exactly, with a '.' as the decimal separator.\n"
+                   " Expressions can be nested too, like \"((a + b)^2 - 2c(a - b))^3\", then\n"
+                   " the parts are expanded and multiplied out, and a part that occurs more\n"
+                   " than once is expanded once.\n\n"
                    );
 }
 
@@ -220,19 +323,167 @@ void argstr_free(void)
 {
     free(argstr);
 }
-/* parses any command line options. */
+/* Reads a positive number for an option, returns -1 if it isn't one. */
+static int option_number( const char *str )
+{
+    char *endptr;
+    long val = strtol( str, &endptr, 10 );
+    if ( endptr == str || *endptr != '\0' || val <= 0 || val > INT_MAX ) {
+        return -1;
+    }
+    return ( int ) val;
+}
+
+static struct option long_opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "preprocess", no_argument, NULL, 'p' },
+    { "eval", no_argument, NULL, 'e' },
+    { "check", no_argument, NULL, 'c' },
+    { "bounds", required_argument, NULL, 'b' },
+    { "top", required_argument, NULL, 't' },
+    { "gray", no_argument, NULL, 'g' },
+    { "format", required_argument, NULL, 'f' },
+    { "order", required_argument, NULL, 'O' }, /* no short option */
+    { "estimate", no_argument, NULL, 'E' }, /* no short option */
+    { "term", required_argument, NULL, 'T' },  /* no short option */
+    { "index", required_argument, NULL, 'I' }, /* no short option */
+    { "shard", required_argument, NULL, 'S' }, /* no short option */
+    { "range", no_argument, NULL, 'R' },    /* no short option */
+    { "max-memory", required_argument, NULL, 'M' }, /* no short option */
+    { "approx", no_argument, NULL, 'A' },   /* no short option */
+    { "prob", no_argument, NULL, 'P' },     /* no short option */
+    { "stats", no_argument, NULL, 'Z' },    /* no short option */
+    { "batch", no_argument, NULL, 'B' },    /* no short option */
+    { "jobs", required_argument, NULL, 'j' },
+    { NULL, 0, NULL, 0 }
+};
+
+/* parses any command line options. The options for the modes sets their
+ * global variables directly. The last of -h and -p wins, but not over a
+ * bad option, or a bad value of an option. */
 int options( int argc, char *argv[] )
 {
     int opt=0;
     opt_tp ret_val= OPT_NONE ;
 
-    while ( ( opt = getopt( argc, argv, ":hp" ) ) != -1 ) {
+    while ( ( opt = getopt_long( argc, argv, ":hpecgb:t:f:j:", long_opts, NULL ) ) != -1 ) {
         switch ( opt ) {
         case 'h':
-            ret_val = OPT_HELP;
+            if (ret_val != OPT_BAD)
+                ret_val = OPT_HELP;
             break;
         case 'p':
-            ret_val = OPT_PREPROCESS;
+            if (ret_val != OPT_BAD)
+                ret_val = OPT_PREPROCESS;
+            break;
+        case 'c':
+            EVAL_CHECK = true;
+            /* fall through */
+        case 'e':
+            EVAL_MODE = true;
+            break;
+        case 'b':
+            BOUNDS_ARG = optarg;
+            break;
+        case 'g':
+            GRAY_ORDER = true;
+            break;
+        case 'E':
+            ESTIMATE_MODE = true;
+            break;
+        case 'T': {
+            char *endptr;
+            errno = 0;
+            TERM_ROW = strtol( optarg, &endptr, 10 );
+            if ( endptr == optarg || *endptr != '\0' || errno != 0 || TERM_ROW < 0 ) {
+                fprintf( stderr, "--term: \"%s\" isn't a row, counting from 0.\n", optarg );
+                ret_val = OPT_BAD;
+            }
+            break;
+        }
+        case 'I':
+            INDEX_ARG = optarg;
+            break;
+        case 'S': {
+            int len = 0;
+            if ( sscanf( optarg, "%d/%d%n", &SHARD, &NR_SHARDS, &len ) != 2 || optarg[len] != '\0'
+                 || NR_SHARDS < 1 || SHARD < 1 || SHARD > NR_SHARDS ) {
+                fprintf( stderr, "--shard: \"%s\" isn't i/N, with i from 1 to N.\n", optarg );
+                SHARD = 1;
+                NR_SHARDS = 1;
+                ret_val = OPT_BAD;
+            }
+            SHARD--;
+            break;
+        }
+        case 'R':
+            RANGE_MODE = true;
+            break;
+        case 'M': {
+            char *endptr;
+            errno = 0;
+            MAX_MEMORY = strtod( optarg, &endptr );
+            switch ( toupper( ( unsigned char ) *endptr ) ) {
+            case 'G':
+                MAX_MEMORY *= 1024.0;
+                /* fall through */
+            case 'M':
+                MAX_MEMORY *= 1024.0;
+                /* fall through */
+            case 'K':
+                MAX_MEMORY *= 1024.0;
+                endptr++;
+            }
+            if ( endptr == optarg || *endptr != '\0' || errno != 0 || !( MAX_MEMORY > 0.0 ) ) {
+                fprintf( stderr, "--max-memory: \"%s\" isn't a size, like 512M.\n", optarg );
+                MAX_MEMORY = 0.0;
+                ret_val = OPT_BAD;
+            }
+            break;
+        }
+        case 'P':
+            APPROX_PROB = true;
+            /* fall through */
+        case 'A':
+            APPROX_MODE = true;
+            break;
+        case 'Z':
+            STATS_MODE = true;
+            break;
+        case 'B':
+            BATCH_MODE = true;
+            break;
+        case 'j':
+            if ( ( NR_JOBS = option_number( optarg ) ) == -1 ) {
+                fprintf( stderr, "--jobs: \"%s\" isn't a positive number.\n", optarg );
+                ret_val = OPT_BAD;
+            }
+            break;
+        case 'f': {
+            int fmt = sink_format( optarg );
+            if ( fmt == -1 ) {
+                fprintf( stderr, "--format: \"%s\" isn't one of text, jsonl, csv or latex.\n", optarg );
+                ret_val = OPT_BAD;
+            } else {
+                OUT_FORMAT = ( out_format ) fmt;
+            }
+            break;
+        }
+        case 'O': {
+            int order = perm_order( optarg );
+            if ( order == -1 ) {
+                fprintf( stderr, "--order: \"%s\" isn't one of lex, grlex, revlex or grevlex.\n", optarg );
+                ret_val = OPT_BAD;
+            } else {
+                TERM_ORDER = ( term_order ) order;
+            }
+            break;
+        }
+        case 't':
+            if ( ( TOP_K = option_number( optarg ) ) == -1 ) {
+                fprintf( stderr, "--top: \"%s\" isn't a positive number.\n", optarg );
+                ret_val = OPT_BAD;
+            }
             break;
         default: /* '?' */
             ret_val = OPT_BAD;
@@ -0,0 +1,481 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "multinom.h"
+/*
+ * batch.c
+ * =======
+ *
+ * The batch mode, --batch, expands every line of standard input as an
+ * expression of its own. The lines are independent, so they are expanded by
+ * a pool of worker threads, that each parses and expands with a state of its
+ * own. The flat lines are parsed by fast_parse(), that doesn't have to take
+ * turns with the other workers for the scanner of multinom.l.
+ *
+ * The main thread reads the lines in chunks of BATCH_CHUNK lines into a ring
+ * of slots, the workers takes the chunks in turn, and expands the lines into
+ * a buffer of the slot. The main thread writes out the slots as they are
+ * done, in the order they were read, so the output is in the order of the
+ * input, whatever order the workers finishes in. The ring holds a few chunks
+ * per worker, so that a worker with a slow chunk doesn't hold up the others,
+ * until the ring is full.
+ */
+
+#define BATCH_CHUNK 64          /* lines a worker takes at the time */
+#define BATCH_SLOTS 4           /* chunks in the ring, per worker */
+
+typedef enum { SLOT_FREE, SLOT_READY, SLOT_BUSY, SLOT_DONE } slot_state;
+
+typedef struct {
+    slot_state state;
+    long first_line;            /* the number of the first line in the chunk */
+    int nr_lines;
+    char *lines[BATCH_CHUNK];
+    size_t caps[BATCH_CHUNK];
+    char *result;               /* what the lines expanded to */
+    size_t result_len;
+    bool failed;                /* any of the lines */
+} batchSlot;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       /* there is a chunk to expand, or no more */
+    pthread_cond_t done;        /* a chunk has been expanded */
+    batchSlot *slots;
+    int nr_slots;
+    long read_seq, take_seq, write_seq; /* chunks read, taken, and written */
+    bool at_eof;
+} batchQueue;
+
+/* --term and --index, one term of the expansion, or the row of one, without
+ * expanding the rest. Returns -1 if there isn't such a term. */
+static int query_term( exprData *expr, int *bounds, FILE *fp, long line )
+{
+    int nr_vars = expr->nrvars,
+        ret_val = 0;
+    termIndex ti;
+
+    if ( !ti_init( &ti, nr_vars, expr->exponent, bounds ) ) {
+        if ( line > 0 )
+            fprintf( stderr, "line %ld: ", line );
+        fprintf( stderr, "%s: The expansion has more terms than fits in a long.\n",
+                 INDEX_ARG != NULL ? "--index" : "--term" );
+        return -1;
+    }
+    if ( INDEX_ARG != NULL ) {
+        int *exps = make_powers( INDEX_ARG, nr_vars, expr->vars );
+        long row = ti_rank( &ti, exps );
+        if ( row == -1 ) {
+            if ( line > 0 )
+                fprintf( stderr, "line %ld: ", line );
+            fprintf( stderr, "--index: \"%s\" isn't a term of the expansion.\n", INDEX_ARG );
+            ret_val = -1;
+        } else {
+            fprintf( fp, "%ld\n", row );
+        }
+        free( exps );
+    } else if ( TERM_ROW >= ti_count( &ti ) ) {
+        if ( line > 0 )
+            fprintf( stderr, "line %ld: ", line );
+        fprintf( stderr, "--term: The expansion has only %ld terms.\n", ti_count( &ti ) );
+        ret_val = -1;
+    } else {
+        int *exps = malloc( nr_vars * sizeof( int ) ),
+            scale = 0;
+        bigNum coeff;
+        if ( exps == NULL ) {
+            expand_fail( "query_term: Out of memory\n" );
+        }
+        ti_unrank( &ti, TERM_ROW, exps );
+        big_init( &coeff );
+        term_coeff( nr_vars, expr->exponent, exps, expr->coeffs, &coeff );
+        for ( int v = 0; v < nr_vars; v++ )
+            scale += expr->scales[v] * exps[v];
+
+        char *digits = big_to_digits( &coeff );
+        termSink *out = sink_open( OUT_FORMAT, fp, nr_vars, expr->vars, strlen( digits ) + 64.0, line );
+        sink_term( out, coeff.neg && !big_is_zero( &coeff ), digits, scale, exps );
+        sink_close( out );
+        free( digits );
+        big_free( &coeff );
+        free( exps );
+    }
+    ti_free( &ti );
+    return ret_val;
+}
+
+/* The terms table of (cx)^n, or of (...)^0, that has one term, or none
+ * outside the bounds, or outside the shard, mk_permtable() only makes
+ * tables of more variables and powers. first gets the number of the row
+ * the table of the shard starts with, like from mk_permtable(). */
+static int one_term_table( int nr_vars, int exponent, int *bounds, long *first, int **terms_table )
+{
+    bool in_bounds = ( exponent == 0 || bounds == NULL || bounds[0] >= exponent );
+    int *row = calloc( nr_vars + 1, sizeof( int ) );
+    if ( row == NULL ) {
+        expand_fail( "one_term_table: Out of memory\n" );
+    }
+    if ( exponent > 0 ) {
+        row[0] = exponent; /* just the one variable */
+    }
+    row[nr_vars] = 1;
+    *terms_table = row;
+    *first = ( SHARD > 0 && in_bounds ) ? 1 : 0;
+    return ( SHARD == 0 && in_bounds ) ? 1 : 0;
+}
+
+/* Prints the stats of --stats, if there are any, and checks the sum
+ * of the coeffecients, when check is true, returns -1 if it isn't right. */
+static int finish_stats( termStats *stats, exprData *expr, FILE *fp, bool check, long line )
+{
+    if ( stats == NULL )
+        return 0;
+    int ret_val = stats_print( stats, fp, expr->nrvars, expr->exponent, expr->coeffs, expr->scales,
+                               check, line );
+    stats_free( stats );
+    return ret_val;
+}
+
+/**
+ * @brief Expands a parsed expression into fp, the way the options says.
+ * @detail The coeffecients in expr are adjusted for the operators. line is
+ * the line of the expression in a batch, or 0. --estimate prints on stdout.
+ * Returns 0, or -1 if the terms table couldn't be made, or there wasn't
+ * a term for --term or --index.
+ */
+int expand_expression( exprData *expr, FILE *fp, long line )
+{
+    int nr_vars = expr->nrvars,
+        exponent = expr->exponent,
+        terms_rows = 0,
+       *terms_table = NULL,
+       *bounds = make_bounds( BOUNDS_ARG, nr_vars, expr->vars );
+    long first = 0;
+    expEstimate est;
+    memPlan plan;
+
+    adjust_coeffs( nr_vars, expr->coeffs, expr->ops );
+    if ( TERM_ROW >= 0 || INDEX_ARG != NULL ) {
+        int ret_val = query_term( expr, bounds, fp, line );
+        free( bounds );
+        return ret_val;
+    }
+    if ( RANGE_MODE ) {
+        free( bounds );
+        return range_expand( OUT_FORMAT, fp, nr_vars, expr->vars, exponent, expr->coeffs, expr->scales );
+    }
+    estimate_expansion( nr_vars, exponent, bounds, expr->coeffs, expr->scales, &est );
+    plan_memory( &est, MAX_MEMORY, ws_threads( est.terms / NR_SHARDS ), &plan );
+    if ( plan.nr_chunks > INT_MAX / NR_SHARDS )
+        plan.nr_chunks = INT_MAX / NR_SHARDS;
+    if ( ESTIMATE_MODE ) {
+        print_estimate( &est );
+        if ( MAX_MEMORY > 0.0 )
+            print_plan( &plan, MAX_MEMORY );
+        free( bounds );
+        return 0;
+    }
+    termStats *stats = NULL;
+    if ( STATS_MODE ) {
+        int max_scale = 0;
+        for ( int v = 0; v < nr_vars; v++ )
+            max_scale = ( expr->scales[v] > max_scale ) ? expr->scales[v] : max_scale;
+        stats = stats_new( max_scale * exponent );
+    }
+    if ( TOP_K == 0 && !GRAY_ORDER && bounds == NULL && NR_SHARDS == 1 && ( nr_vars == 2 || nr_vars == 3 )
+         && est.width == W_LONG && TERM_ORDER <= ORD_GRLEX && !APPROX_MODE ) {
+       /* Binomials and trinomials have fast paths of their own, in lex order. */
+        termSink *out = ( stats != NULL ) ? sink_stats( fp, nr_vars, stats )
+            : sink_open( OUT_FORMAT, fp, nr_vars, expr->vars, est.out_bytes, line );
+        expand_small( nr_vars, exponent, expr->coeffs, expr->scales, out );
+        sink_close( out );
+        return finish_stats( stats, expr, fp, true, line );
+    }
+    if ( TOP_K == 0 && !GRAY_ORDER ) {
+       /* The first chunk of the table, of the shard. */
+        if ( nr_vars == 1 || exponent == 0 ) {
+            terms_rows = one_term_table( nr_vars, exponent, bounds, &first, &terms_table );
+            plan.nr_chunks = 1;
+        } else {
+            terms_rows = mk_permtable( nr_vars, exponent, bounds, SHARD * plan.nr_chunks,
+                                       NR_SHARDS * plan.nr_chunks, &first, &terms_table );
+        }
+        if ( terms_rows == -1 ) {
+            if ( stats != NULL )
+                stats_free( stats );
+            free( bounds );
+            return -1;
+        }
+    }
+
+    termSink *out = ( stats != NULL ) ? sink_stats( fp, nr_vars, stats )
+        : ( NR_SHARDS > 1 )
+        ? sink_shard( OUT_FORMAT, fp, nr_vars, expr->vars, est.out_bytes / NR_SHARDS, SHARD, NR_SHARDS, first )
+        : sink_open( OUT_FORMAT, fp, nr_vars, expr->vars, est.out_bytes, line );
+    out->spool = plan.spool && stats == NULL;
+    if ( TOP_K > 0 ) {
+       /* No terms table, just the biggest terms. */
+        top_terms( TOP_K, nr_vars, exponent, bounds, expr->coeffs, expr->scales, out );
+    } else if ( GRAY_ORDER ) {
+       /* No terms table either, every term follows from the last. */
+        gray_expand( nr_vars, exponent, expr->coeffs, expr->scales, out );
+    } else {
+        for ( int chunk = 1;; chunk++ ) {
+            expand_expr( terms_rows, nr_vars, exponent, terms_table, expr->coeffs, expr->scales, out );
+            free( terms_table );
+            if ( chunk == plan.nr_chunks )
+                break;
+            TRACE( memory_chunk, chunk, plan.nr_chunks, terms_rows );
+           /* The next chunk, with the terms after the ones in out. */
+            terms_rows = mk_permtable( nr_vars, exponent, bounds, SHARD * plan.nr_chunks + chunk,
+                                       NR_SHARDS * plan.nr_chunks, NULL, &terms_table );
+        }
+    }
+    sink_close( out );
+    bool check = ( bounds == NULL );
+    free( bounds );
+    return finish_stats( stats, expr, fp, check, line );
+}
+
+/* Reads the next chunk of lines into slot, returns false at the end of in. */
+static bool read_chunk( FILE *in, batchSlot *slot, long *lineno )
+{
+    slot->first_line = *lineno + 1;
+    slot->nr_lines = 0;
+    while ( slot->nr_lines < BATCH_CHUNK ) {
+        int i = slot->nr_lines;
+        ssize_t len = getline( &slot->lines[i], &slot->caps[i], in );
+        if ( len == -1 ) {
+            return false;
+        }
+        if ( len > 0 && slot->lines[i][len - 1] == '\n' ) {
+            slot->lines[i][len - 1] = '\0';
+        }
+        slot->nr_lines++;
+        ( *lineno )++;
+    }
+    return true;
+}
+
+/* Expands one line into fp. An error in the expansion, from expand_fail(),
+ * gives up on the line, and what it had written to fp is taken back, the
+ * memory the expansion had taken, besides the tables of expr, is lost. */
+static int expand_line( const char *line, long lineno, FILE *fp )
+{
+    jmp_buf err_jmp;
+    exprData expr;
+    bool nested = expr_is_nested( line );
+    long start = ftell( fp );
+    int ret_val;
+
+    if ( !nested && fast_parse( line, lineno, &expr ) == -1 ) {
+        return -1;
+    }
+    if ( setjmp( err_jmp ) != 0 ) {
+        LINE_ERR_JMP = NULL;
+        fseek( fp, start, SEEK_SET );
+        if ( !nested ) {
+            free_vartables( &expr.vars, &expr.coeffs, &expr.scales, &expr.ops );
+        }
+        return -1;
+    }
+    LINE_ERR_JMP = &err_jmp;
+    if ( nested ) {
+        ret_val = tree_expand( line, fp, lineno, false );
+    } else {
+        ret_val = expand_expression( &expr, fp, lineno );
+        free_vartables( &expr.vars, &expr.coeffs, &expr.scales, &expr.ops );
+    }
+    LINE_ERR_JMP = NULL;
+    return ret_val;
+}
+
+/* Expands every line of the chunk into the buffer of the slot. */
+static void expand_chunk( batchSlot *slot )
+{
+    FILE *fp = open_memstream( &slot->result, &slot->result_len );
+    if ( fp == NULL ) {
+        fprintf( stderr, "lines %ld-%ld: batch: open_memstream: %s\n", slot->first_line,
+                 slot->first_line + slot->nr_lines - 1, strerror( errno ) );
+        slot->result = NULL;
+        slot->result_len = 0;
+        slot->failed = true;
+        return;
+    }
+    slot->failed = false;
+    for ( int i = 0; i < slot->nr_lines; i++ ) {
+        const char *line = slot->lines[i];
+
+        if ( line[strspn( line, " \t\r" )] == '\0' ) {
+            continue;
+        }
+        if ( expand_line( line, slot->first_line + i, fp ) == -1 ) {
+            slot->failed = true;
+        }
+    }
+    fclose( fp );
+}
+
+static void *batch_worker( void *arg )
+{
+    batchQueue *q = arg;
+
+    pthread_mutex_lock( &q->lock );
+    for ( ;; ) {
+        while ( q->take_seq == q->read_seq && !q->at_eof ) {
+            pthread_cond_wait( &q->ready, &q->lock );
+        }
+        if ( q->take_seq == q->read_seq ) {
+            break;
+        }
+        batchSlot *slot = &q->slots[q->take_seq++ % q->nr_slots];
+        slot->state = SLOT_BUSY;
+        pthread_mutex_unlock( &q->lock );
+
+        expand_chunk( slot );
+
+        pthread_mutex_lock( &q->lock );
+        slot->state = SLOT_DONE;
+        pthread_cond_signal( &q->done );
+    }
+    pthread_mutex_unlock( &q->lock );
+    return NULL;
+}
+
+/* Writes out the chunks that are done, in order, and frees their slots.
+ * Waits for the oldest chunk first, if wait is true. Returns false if any
+ * of the lines failed. */
+static bool write_chunks( batchQueue *q, FILE *out, bool wait )
+{
+    bool ok = true;
+
+    pthread_mutex_lock( &q->lock );
+    while ( q->write_seq < q->read_seq ) {
+        batchSlot *slot = &q->slots[q->write_seq % q->nr_slots];
+        if ( slot->state != SLOT_DONE ) {
+            if ( !wait ) {
+                break;
+            }
+            pthread_cond_wait( &q->done, &q->lock );
+            continue;
+        }
+        pthread_mutex_unlock( &q->lock );
+
+        if ( slot->result_len > 0 && fwrite( slot->result, 1, slot->result_len, out ) != slot->result_len ) {
+            perror( "batch: write" );
+            exit( EXIT_FAILURE );
+        }
+        ok = ok && !slot->failed;
+        free( slot->result );
+        slot->result = NULL;
+
+        pthread_mutex_lock( &q->lock );
+        slot->state = SLOT_FREE;
+        q->write_seq++;
+        wait = false;
+    }
+    pthread_mutex_unlock( &q->lock );
+    return ok;
+}
+
+/**
+ * @brief Expands every line of in, with nr_threads workers, or one per cpu
+ * if it is 0, and writes the expansions to out, in the order of the lines.
+ * @detail Returns 0, or -1 if any of the lines had an error, those are
+ * reported on stderr with the number of the line, and have no output.
+ */
+int batch_run( FILE *in, FILE *out, int nr_threads )
+{
+    batchQueue q;
+    pthread_t *workers;
+    long lineno = 0;
+    bool ok = true,
+        more = true;
+
+    if ( nr_threads <= 0 ) {
+        long nr_cpus = sysconf( _SC_NPROCESSORS_ONLN );
+        nr_threads = ( nr_cpus > 0 ) ? ( int ) nr_cpus : 1;
+    }
+    pthread_mutex_init( &q.lock, NULL );
+    pthread_cond_init( &q.ready, NULL );
+    pthread_cond_init( &q.done, NULL );
+    q.nr_slots = nr_threads * BATCH_SLOTS;
+    q.slots = calloc( q.nr_slots, sizeof( batchSlot ) );
+    workers = malloc( nr_threads * sizeof( pthread_t ) );
+    if ( q.slots == NULL || workers == NULL ) {
+        fprintf( stderr, "batch_run: Out of memory, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
+    q.read_seq = q.take_seq = q.write_seq = 0;
+    q.at_eof = false;
+    for ( int t = 0; t < nr_threads; t++ ) {
+        if ( pthread_create( &workers[t], NULL, batch_worker, &q ) != 0 ) {
+            fprintf( stderr, "batch_run: Can't start the worker threads, exiting\n" );
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    while ( more ) {
+       /* The slot we read into is free, once the chunk before it in the
+          ring has been written. */
+        ok = write_chunks( &q, out, q.read_seq - q.write_seq == q.nr_slots ) && ok;
+
+        batchSlot *slot = &q.slots[q.read_seq % q.nr_slots];
+        more = read_chunk( in, slot, &lineno );
+
+        pthread_mutex_lock( &q.lock );
+        if ( slot->nr_lines > 0 ) {
+            slot->state = SLOT_READY;
+            q.read_seq++;
+        }
+        q.at_eof = !more;
+        pthread_cond_broadcast( &q.ready );
+        pthread_mutex_unlock( &q.lock );
+    }
+    while ( q.write_seq < q.read_seq ) {
+        ok = write_chunks( &q, out, true ) && ok;
+    }
+    fflush( out );
+
+    for ( int t = 0; t < nr_threads; t++ ) {
+        pthread_join( workers[t], NULL );
+    }
+    for ( int s = 0; s < q.nr_slots; s++ ) {
+        for ( int i = 0; i < BATCH_CHUNK; i++ ) {
+            free( q.slots[s].lines[i] );
+        }
+    }
+    free( q.slots );
+    free( workers );
+    pthread_cond_destroy( &q.done );
+    pthread_cond_destroy( &q.ready );
+    pthread_mutex_destroy( &q.lock );
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,265 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "multinom.h"
+/*
+ * bignum.c
+ * ========
+ *
+ * Just enough of a multi precision integer, for the coeffecients that
+ * doesn't fit in 128 bits: we multiply and divide with numbers that fits in
+ * 32 bits, multiply two of them for the product trees in primefact.c, add
+ * them for the like terms of exprtree.c, and converts to decimal digits for
+ * printing.
+ * The magnitude is stored in 32 bit limbs, the least significant first,
+ * zero has no limbs at all.
+ */
+
+#define BIG_BASE 4294967296ULL  /* 2^32 */
+
+void big_init( bigNum *b )
+{
+    b->limb = NULL;
+    b->len = 0;
+    b->cap = 0;
+    b->neg = false;
+}
+
+void big_free( bigNum *b )
+{
+    free( b->limb );
+    big_init( b );
+}
+
+static void big_grow( bigNum *b, int cap )
+{
+    if ( cap <= b->cap )
+        return;
+    cap = ( cap < 2 * b->cap ) ? 2 * b->cap : cap;
+    uint32_t *limb = realloc( b->limb, cap * sizeof( uint32_t ) );
+    if ( limb == NULL ) {
+        expand_fail( "bignum: Out of memory\n" );
+    }
+    b->limb = limb;
+    b->cap = cap;
+}
+
+/* Makes room for a magnitude of bits bits, up front. */
+void big_reserve( bigNum *b, int bits )
+{
+    big_grow( b, bits / 32 + 1 );
+}
+
+void big_set( bigNum *b, long val )
+{
+    unsigned long mag = ( val < 0 ) ? -( unsigned long ) val : ( unsigned long ) val;
+
+    b->neg = ( val < 0 );
+    b->len = 0;
+    big_grow( b, 2 );
+    while ( mag > 0 ) {
+        b->limb[b->len++] = ( uint32_t ) mag;
+        mag >>= 32;
+    }
+}
+
+#ifdef __SIZEOF_INT128__
+void big_set_int128( bigNum *b, __int128 val )
+{
+    unsigned __int128 mag = ( val < 0 ) ? -( unsigned __int128 ) val : ( unsigned __int128 ) val;
+
+    b->neg = ( val < 0 );
+    b->len = 0;
+    big_grow( b, 4 );
+    while ( mag > 0 ) {
+        b->limb[b->len++] = ( uint32_t ) mag;
+        mag >>= 32;
+    }
+}
+#endif
+
+void big_copy( bigNum *dst, const bigNum *src )
+{
+    big_grow( dst, src->len );
+    if ( src->len > 0 )
+        memcpy( dst->limb, src->limb, src->len * sizeof( uint32_t ) );
+    dst->len = src->len;
+    dst->neg = src->neg;
+}
+
+/* b *= m, where |m| < 2^32 */
+void big_mul_small( bigNum *b, long m )
+{
+    uint64_t mag = ( m < 0 ) ? -( uint64_t ) m : ( uint64_t ) m,
+        carry = 0;
+
+    if ( m < 0 )
+        b->neg = !b->neg;
+    if ( mag == 0 ) {
+        b->len = 0;
+        return;
+    }
+    for ( int i = 0; i < b->len; i++ ) {
+        uint64_t cur = ( uint64_t ) b->limb[i] * mag + carry;
+        b->limb[i] = ( uint32_t ) cur;
+        carry = cur >> 32;
+    }
+    if ( carry > 0 ) {
+        big_grow( b, b->len + 1 );
+        b->limb[b->len++] = ( uint32_t ) carry;
+    }
+}
+
+/* res = a * b, by the school book, res may not be a or b. */
+void big_mul( bigNum *res, const bigNum *a, const bigNum *b )
+{
+    res->neg = ( a->neg != b->neg );
+    if ( a->len == 0 || b->len == 0 ) {
+        res->len = 0;
+        return;
+    }
+    big_grow( res, a->len + b->len );
+    memset( res->limb, 0, ( a->len + b->len ) * sizeof( uint32_t ) );
+    for ( int i = 0; i < a->len; i++ ) {
+        uint64_t carry = 0;
+        for ( int j = 0; j < b->len; j++ ) {
+            uint64_t cur = ( uint64_t ) a->limb[i] * b->limb[j] + res->limb[i + j] + carry;
+            res->limb[i + j] = ( uint32_t ) cur;
+            carry = cur >> 32;
+        }
+        res->limb[i + b->len] = ( uint32_t ) carry;
+    }
+    res->len = a->len + b->len;
+    while ( res->len > 0 && res->limb[res->len - 1] == 0 )
+        res->len--;
+}
+
+/* Compares the magnitudes of a and b, like strcmp(). */
+int big_cmp_mag( const bigNum *a, const bigNum *b )
+{
+    if ( a->len != b->len )
+        return ( a->len < b->len ) ? -1 : 1;
+    for ( int i = a->len - 1; i >= 0; i-- ) {
+        if ( a->limb[i] != b->limb[i] )
+            return ( a->limb[i] < b->limb[i] ) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* res += b, with the signs, res may not be b. */
+void big_add( bigNum *res, const bigNum *b )
+{
+    if ( b->len == 0 )
+        return;
+    if ( res->len == 0 || res->neg == b->neg ) {
+        uint64_t carry = 0;
+        int len = ( res->len > b->len ) ? res->len : b->len;
+        big_grow( res, len + 1 );
+        for ( int i = 0; i < len; i++ ) {
+            uint64_t cur = carry + ( ( i < res->len ) ? res->limb[i] : 0 ) + ( ( i < b->len ) ? b->limb[i] : 0 );
+            res->limb[i] = ( uint32_t ) cur;
+            carry = cur >> 32;
+        }
+        res->neg = b->neg;
+        res->len = len;
+        if ( carry > 0 )
+            res->limb[res->len++] = ( uint32_t ) carry;
+        return;
+    }
+   /* The signs differ, the smaller magnitude is taken from the bigger. */
+    const bigNum *big = b,
+        *small = res;
+    if ( big_cmp_mag( res, b ) >= 0 ) {
+        big = res;
+        small = b;
+    }
+    big_grow( res, big->len );
+    int64_t borrow = 0;
+    for ( int i = 0; i < big->len; i++ ) {
+        int64_t cur = ( int64_t ) big->limb[i] - ( ( i < small->len ) ? small->limb[i] : 0 ) - borrow;
+        borrow = ( cur < 0 );
+        res->limb[i] = ( uint32_t ) ( cur + ( borrow ? ( int64_t ) BIG_BASE : 0 ) );
+    }
+    res->neg = big->neg;
+    res->len = big->len;
+    while ( res->len > 0 && res->limb[res->len - 1] == 0 )
+        res->len--;
+}
+
+/* b /= d, where 0 < d < 2^32, returns the remainder */
+uint32_t big_div_small( bigNum *b, uint32_t d )
+{
+    uint64_t rem = 0;
+
+    for ( int i = b->len - 1; i >= 0; i-- ) {
+        uint64_t cur = ( rem << 32 ) | b->limb[i];
+        b->limb[i] = ( uint32_t ) ( cur / d );
+        rem = cur % d;
+    }
+    while ( b->len > 0 && b->limb[b->len - 1] == 0 )
+        b->len--;
+    return ( uint32_t ) rem;
+}
+
+bool big_is_zero( const bigNum *b )
+{
+    return b->len == 0;
+}
+
+/**
+ * @brief The decimal digits of |b|, in a string that the caller frees.
+ * @detail We peel off nine digits at the time, from a copy.
+ */
+char *big_to_digits( const bigNum *b )
+{
+    bigNum tmp;
+    int max_digits = b->len * 10 + 1;
+    char *digits = malloc( max_digits + 1 );
+    if ( digits == NULL ) {
+        expand_fail( "bignum: Out of memory\n" );
+    }
+    if ( b->len == 0 ) {
+        strcpy( digits, "0" );
+        return digits;
+    }
+    big_init( &tmp );
+    big_grow( &tmp, b->len );
+    memcpy( tmp.limb, b->limb, b->len * sizeof( uint32_t ) );
+    tmp.len = b->len;
+
+    int pos = max_digits;
+    digits[pos] = '\0';
+    while ( tmp.len > 0 ) {
+        uint32_t chunk = big_div_small( &tmp, 1000000000U );
+        for ( int i = 0; i < 9 && ( tmp.len > 0 || chunk > 0 ); i++ ) {
+            digits[--pos] = '0' + chunk % 10;
+            chunk /= 10;
+        }
+    }
+    big_free( &tmp );
+    memmove( digits, digits + pos, max_digits - pos + 1 );
+    return digits;
+}
@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "multinom.h"
+/*
+ * coeffsimd.c
+ * ===========
+ *
+ * The coeffecients of a block of terms at once, for expand_long(). The
+ * powers of the terms in the block are stored column by column,
+ * exps[v * COEFF_BLOCK + j] is the power of variable v in term j, so the
+ * powers of one variable for consecutive terms are next to each other, and
+ * coeffs[j] comes in with the multinomial coeffecient of term j, and is
+ * multiplied with pwrtbl[v * ( exponent + 1 ) + exps[...]] == c_v^e for
+ * every variable, there are no branches on the powers or the coeffecients.
+ *
+ * On x86-64 the kernel is chosen at runtime: AVX2 does four terms in a
+ * vector, two vectors at the time, gathering the powers from the table,
+ * SSE4.1 does two terms in a vector, and otherwise it is a plain loop.
+ * Neither has a 64 bit multiply, so it is made from 32 bit ones, the low 64
+ * bits are the same for signed numbers. Build with -DNO_SIMD for just the
+ * plain loop.
+ */
+
+#if defined( __x86_64__ ) && defined( __GNUC__ ) && !defined( NO_SIMD )
+#define COEFF_X86
+#include <immintrin.h>
+#endif
+
+typedef void ( *coeff_kernel ) ( int nr_vars, int exponent, int nr_terms, const long *pwrtbl,
+                                 const int *exps, long *coeffs );
+
+static void coeff_block_scalar( int nr_vars, int exponent, int nr_terms, const long *pwrtbl,
+                                const int *exps, long *coeffs )
+{
+    for ( int v = 0; v < nr_vars; v++ ) {
+        const long *pwr = pwrtbl + v * ( exponent + 1 );
+        const int *col = exps + v * COEFF_BLOCK;
+        for ( int j = 0; j < nr_terms; j++ )
+            coeffs[j] *= pwr[col[j]];
+    }
+}
+
+#ifdef COEFF_X86
+/* The low 64 bits of a * b, in every lane. */
+__attribute__ ( ( target( "avx2" ) ) )
+static inline __m256i mul64_avx2( __m256i a, __m256i b )
+{
+    __m256i cross = _mm256_mullo_epi32( a, _mm256_shuffle_epi32( b, 0xB1 ) );
+    cross = _mm256_add_epi32( cross, _mm256_srli_epi64( cross, 32 ) );
+    cross = _mm256_slli_epi64( cross, 32 );
+    return _mm256_add_epi64( _mm256_mul_epu32( a, b ), cross );
+}
+
+__attribute__ ( ( target( "avx2" ) ) )
+static void coeff_block_avx2( int nr_vars, int exponent, int nr_terms, const long *pwrtbl,
+                              const int *exps, long *coeffs )
+{
+    int j = 0;
+    for ( ; j + 8 <= nr_terms; j += 8 ) {
+        __m256i acc0 = _mm256_loadu_si256( ( const __m256i * ) ( coeffs + j ) ),
+            acc1 = _mm256_loadu_si256( ( const __m256i * ) ( coeffs + j + 4 ) );
+        for ( int v = 0; v < nr_vars; v++ ) {
+            const long long *pwr = ( const long long * ) ( pwrtbl + v * ( exponent + 1 ) );
+            const int *col = exps + v * COEFF_BLOCK + j;
+            __m256i p0 = _mm256_i32gather_epi64( pwr, _mm_loadu_si128( ( const __m128i * ) col ), 8 ),
+                p1 = _mm256_i32gather_epi64( pwr, _mm_loadu_si128( ( const __m128i * ) ( col + 4 ) ), 8 );
+            acc0 = mul64_avx2( acc0, p0 );
+            acc1 = mul64_avx2( acc1, p1 );
+        }
+        _mm256_storeu_si256( ( __m256i * ) ( coeffs + j ), acc0 );
+        _mm256_storeu_si256( ( __m256i * ) ( coeffs + j + 4 ), acc1 );
+    }
+    for ( ; j < nr_terms; j++ ) {
+        for ( int v = 0; v < nr_vars; v++ )
+            coeffs[j] *= pwrtbl[v * ( exponent + 1 ) + exps[v * COEFF_BLOCK + j]];
+    }
+}
+
+__attribute__ ( ( target( "sse4.1" ) ) )
+static inline __m128i mul64_sse( __m128i a, __m128i b )
+{
+    __m128i cross = _mm_mullo_epi32( a, _mm_shuffle_epi32( b, 0xB1 ) );
+    cross = _mm_add_epi32( cross, _mm_srli_epi64( cross, 32 ) );
+    cross = _mm_slli_epi64( cross, 32 );
+    return _mm_add_epi64( _mm_mul_epu32( a, b ), cross );
+}
+
+__attribute__ ( ( target( "sse4.1" ) ) )
+static void coeff_block_sse( int nr_vars, int exponent, int nr_terms, const long *pwrtbl,
+                             const int *exps, long *coeffs )
+{
+    int j = 0;
+    for ( ; j + 4 <= nr_terms; j += 4 ) {
+        __m128i acc0 = _mm_loadu_si128( ( const __m128i * ) ( coeffs + j ) ),
+            acc1 = _mm_loadu_si128( ( const __m128i * ) ( coeffs + j + 2 ) );
+        for ( int v = 0; v < nr_vars; v++ ) {
+            const long *pwr = pwrtbl + v * ( exponent + 1 );
+            const int *col = exps + v * COEFF_BLOCK + j;
+            acc0 = mul64_sse( acc0, _mm_set_epi64x( pwr[col[1]], pwr[col[0]] ) );
+            acc1 = mul64_sse( acc1, _mm_set_epi64x( pwr[col[3]], pwr[col[2]] ) );
+        }
+        _mm_storeu_si128( ( __m128i * ) ( coeffs + j ), acc0 );
+        _mm_storeu_si128( ( __m128i * ) ( coeffs + j + 2 ), acc1 );
+    }
+    for ( ; j < nr_terms; j++ ) {
+        for ( int v = 0; v < nr_vars; v++ )
+            coeffs[j] *= pwrtbl[v * ( exponent + 1 ) + exps[v * COEFF_BLOCK + j]];
+    }
+}
+#endif
+
+static coeff_kernel kernel = coeff_block_scalar;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void choose_kernel( void )
+{
+#ifdef COEFF_X86
+    __builtin_cpu_init(  );
+    if ( __builtin_cpu_supports( "avx2" ) )
+        kernel = coeff_block_avx2;
+    else if ( __builtin_cpu_supports( "sse4.1" ) )
+        kernel = coeff_block_sse;
+#endif
+}
+
+/* The name of the kernel coeff_block_long() uses, for --estimate. */
+const char *coeff_kernel_name( void )
+{
+    pthread_once( &kernel_once, choose_kernel );
+#ifdef COEFF_X86
+    if ( kernel == coeff_block_avx2 )
+        return "avx2";
+    if ( kernel == coeff_block_sse )
+        return "sse4.1";
+#endif
+    return "scalar";
+}
+
+/**
+ * @brief Multiplies coeffs[j], the multinomial coeffecient of term j in the
+ * block, with the powers of the coeffecients of the variables in the term.
+ * @detail The products must fit in a long, which coeff_width() makes sure
+ * of. nr_terms is at most COEFF_BLOCK.
+ */
+void coeff_block_long( int nr_vars, int exponent, int nr_terms, const long *pwrtbl,
+                       const int *exps, long *coeffs )
+{
+    pthread_once( &kernel_once, choose_kernel );
+    kernel( nr_vars, exponent, nr_terms, pwrtbl, exps, coeffs );
+}
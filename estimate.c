@@ -0,0 +1,240 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+#include "multinom.h"
+/*
+ * estimate.c
+ * ==========
+ *
+ * Tells how big an expansion is going to be, without expanding it: the
+ * number of terms, about how many bytes the printout takes, how many bits
+ * the biggest coeffecient may need, and how much memory each of the ways to
+ * expand it needs at the most.
+ *
+ * The counts are done in doubles, they are exact as long as they are below
+ * 2^53, and too big is too big anyway.
+ */
+
+/* ways[r] is the number of ways the variables, except skip, can have powers
+ * that add up to r, within their bounds, for r == 0..n. */
+static void count_ways( int k, int n, int *lim, int skip, double *ways, double *prefix )
+{
+    for ( int r = 0; r <= n; r++ )
+        ways[r] = ( r == 0 ) ? 1.0 : 0.0;
+    for ( int i = 0; i < k; i++ ) {
+        if ( i == skip )
+            continue;
+        prefix[0] = 0.0;
+        for ( int r = 0; r <= n; r++ )
+            prefix[r + 1] = prefix[r] + ways[r];
+        for ( int r = 0; r <= n; r++ ) {
+            int lowest = ( r - lim[i] > 0 ) ? r - lim[i] : 0;
+            ways[r] = prefix[r + 1] - prefix[lowest];
+        }
+    }
+}
+
+/* The chars it takes to print a variable raised to e, like "x^12" */
+static int raised_var_len( int e )
+{
+    int len = 2; /* "x^" */
+    if ( e == 0 )
+        return 0;
+    if ( e == 1 )
+        return 1;
+    for ( ; e > 0; e /= 10 )
+        len++;
+    return len;
+}
+
+/**
+ * @brief Estimates the expansion of the multinomial, bounds is the same as
+ * for mk_permtable(), and may be NULL.
+ * @detail The coefftbl must have been adjusted for the operators with
+ * adjust_coeffs() first.
+ *
+ * The number of terms is exact, and so are the chars of the variables, we
+ * count how many terms every variable is raised to every power in. The
+ * coeffecients add up to at most ( |c1| + ... + |ck| )^n, so we take the
+ * digits of the average of them, which is a bit more than the average of
+ * the digits.
+ */
+void estimate_expansion( int nr_vars, int exponent, int *bounds, int *coefftbl, int *scaletbl,
+                         expEstimate *est )
+{
+    int n = exponent;
+    int *lim = malloc( nr_vars * sizeof( int ) );
+    double *ways = malloc( ( n + 1 ) * sizeof( double ) );
+    double *prefix = malloc( ( n + 2 ) * sizeof( double ) );
+    if ( lim == NULL || ways == NULL || prefix == NULL ) {
+        expand_fail( "estimate_expansion: Out of memory\n" );
+    }
+    for ( int i = 0; i < nr_vars; i++ )
+        lim[i] = ( bounds != NULL && bounds[i] < n ) ? bounds[i] : n;
+
+    count_ways( nr_vars, n, lim, -1, ways, prefix );
+    est->terms = ways[n];
+
+   /* The chars of the variables, and the decimals of the coeffecients. */
+    double var_chars = 0.0,
+        decimals = 0.0,
+        log10_sum = 0.0;
+    for ( int i = 0; i < nr_vars; i++ ) {
+        if ( bounds != NULL || i == 0 )
+            count_ways( nr_vars, n, lim, i, ways, prefix ); /* all the same without bounds */
+        for ( int e = 1; e <= lim[i]; e++ ) {
+            var_chars += raised_var_len( e ) * ways[n - e];
+            decimals += ( double ) scaletbl[i] * e * ways[n - e];
+        }
+        long abs_coeff = labs( ( long ) coefftbl[i] );
+        log10_sum += ( abs_coeff > 1 ) ? ( double ) abs_coeff : 1.0;
+    }
+    log10_sum = log10( log10_sum );
+
+    est->coeff_bits = coeff_bound_bits( nr_vars, n, coefftbl );
+    est->width = APPROX_MODE ? W_LOG : coeff_width( nr_vars, n, coefftbl );
+    if ( est->terms == 0.0 ) {
+        est->out_bytes = 2.0; /* "0\n" */
+    } else if ( est->width == W_LOG ) {
+       /* 1.234567890e+4321, the exponent a few digits */
+        est->out_bytes = est->terms * 17.0 + var_chars + 3.0 * ( est->terms - 1.0 ) + 1.0;
+    } else {
+        double max_digits = floor( est->coeff_bits * log10( 2.0 ) ) + 1.0,
+            digits = floor( n * log10_sum - log10( est->terms ) ) + 1.0,
+            scale = decimals / est->terms;
+        digits = ( digits < 1.0 ) ? 1.0 : ( digits > max_digits ) ? max_digits : digits;
+        if ( scale > 0.0 )
+            digits = ( ( digits > scale + 1.0 ) ? digits : scale + 1.0 ) + 1.0; /* the '.' */
+       /* " + " between the terms, and a newline at the end. */
+        est->out_bytes = est->terms * digits + var_chars + 3.0 * ( est->terms - 1.0 ) + 1.0;
+    }
+
+   /* The terms table, and the power tables of the widest integers we use. */
+    double pwr_width;
+    bool bits_needed = true;
+    switch ( est->width ) {
+    case W_LONG:
+        pwr_width = sizeof( long );
+        break;
+#ifdef __SIZEOF_INT128__
+    case W_INT128:
+        pwr_width = sizeof( __int128 );
+        break;
+#endif
+    case W_LOG:
+        pwr_width = sizeof( double ); /* log10 of the factorials */
+        bits_needed = false;
+        break;
+    default:
+        pwr_width = 0.0; /* the bignums are multiplied up from scratch */
+    }
+    double table = est->terms * ( nr_vars + 1 ) * sizeof( int ),
+        bits_mem = bits_needed ? 2.0 * ( est->coeff_bits / 32.0 + 1.0 ) * sizeof( uint32_t ) : 0.0;
+    est->mem_fixed = ( double ) ( est->width == W_LOG ? 1 : nr_vars ) * ( n + 1 ) * pwr_width + bits_mem;
+    est->mem_table = table + est->mem_fixed;
+    est->mem_eval = table + eval_memory( nr_vars, n );
+    est->mem_top = top_terms_memory( 0, nr_vars, est->terms );
+    est->mem_top_per_k = top_terms_memory( 1, nr_vars, est->terms ) - est->mem_top;
+    est->mem_top_max = top_terms_memory( INT_MAX, nr_vars, est->terms );
+    est->mem_gray = gray_memory( nr_vars );
+
+    free( prefix );
+    free( ways );
+    free( lim );
+}
+
+/* Prints counts exactly, as long as they are exact. */
+static void print_amount( const char *label, double val, const char *unit )
+{
+    if ( val < 9007199254740992.0 ) /* 2^53 */
+        printf( "%-15s%.0f%s\n", label, val, unit );
+    else
+        printf( "%-15s%.3e%s\n", label, val, unit );
+}
+
+void print_estimate( const expEstimate *est )
+{
+    static const char *width_name[] = { "long", "__int128", "bignum", "log10 doubles, --approx" };
+
+    print_amount( "terms:", est->terms, "" );
+    print_amount( "output:", est->out_bytes, " bytes, about" );
+    printf( "%-15s%.0f bits at the most, computed in %s", "coeffecients:", ceil( est->coeff_bits ),
+            width_name[est->width] );
+    if ( est->width == W_LONG )
+        printf( ", by the %s kernel", coeff_kernel_name(  ) );
+    printf( "\n" );
+    printf( "peak memory:\n" );
+    print_amount( "  expand:", est->mem_table, " bytes" );
+    if ( est->terms > INT_MAX )
+        printf( "%-15s(too many terms for the terms table)\n", "" );
+    print_amount( "  -e, -c:", est->mem_eval, " bytes" );
+    printf( "%-15s%.0f + K * %.0f bytes\n", "  --top K:", est->mem_top, est->mem_top_per_k );
+    if ( est->terms < INT_MAX )
+        printf( "%-15s(at most %.0f bytes, the heap has at most the %.0f terms)\n", "", est->mem_top_max, est->terms );
+    print_amount( "  -g:", est->mem_gray, " bytes" );
+}
+
+/**
+ * @brief Plans the expansion of the terms table within budget bytes of
+ * memory, from the estimate.
+ * @detail The whole table, when it fits, else the table is made and
+ * expanded in chunks, small enough to leave half of the room for the
+ * output. The fixed part of the memory, like the power tables, is small
+ * and not in the chunks. The workers of a parallel expansion keeps the
+ * output of their rows until it is their turn to write it, so that output
+ * goes to temporary files instead, when it wouldn't fit with the table.
+ * A budget of 0 is no budget.
+ */
+void plan_memory( const expEstimate *est, double budget, int nr_threads, memPlan *plan )
+{
+    plan->nr_chunks = 1;
+    plan->spool = false;
+    if ( budget <= 0.0 )
+        return;
+
+    double table = est->mem_table - est->mem_fixed,
+        room = budget - est->mem_fixed;
+    if ( room < budget / 2.0 )
+        room = budget / 2.0;
+    if ( table > room ) {
+        double chunks = ceil( table / ( room / 2.0 ) );
+        if ( chunks > est->terms )
+            chunks = est->terms; /* a row is as small as a chunk gets */
+        plan->nr_chunks = ( chunks > INT_MAX ) ? INT_MAX : ( int ) chunks;
+    }
+    plan->spool = ( nr_threads > 1 && ( table + est->out_bytes ) / plan->nr_chunks > room );
+}
+
+void print_plan( const memPlan *plan, double budget )
+{
+    print_amount( "budget:", budget, " bytes" );
+    if ( plan->nr_chunks == 1 )
+        printf( "%-15sthe whole terms table in memory", "plan:" );
+    else
+        printf( "%-15sthe terms table in %d chunks, one at the time", "plan:", plan->nr_chunks );
+    printf( plan->spool ? ", the output of the workers spooled to temporary files\n" : "\n" );
+}
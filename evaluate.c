@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "multinom.h"
+/*
+ * evaluate.c
+ * ==========
+ *
+ * Numeric evaluation of the expanded multinomial, at points read from a
+ * stream, one point per line, with one value per variable, in the order the
+ * variables occur in the expression.
+ *
+ * The points are evaluated a block at a time: for every variable we make a
+ * table with the powers 0..exponent of the coeffecient times the value of the
+ * variable, for all the points in the block. A term is then the multinomial
+ * coeffecient times a product of rows from those tables, and the loops over
+ * the points in a block has no branches, so the compiler can vectorize them.
+ */
+
+#define EVAL_BLOCK 64           /* points per block */
+#define EVAL_TOLERANCE 1e-10    /* relative to (|c1x1| + |c2x2| + ...)^n */
+
+/* The coeffecient of a variable as a double, with the decimal point
+ * put back in. */
+static double coeff2double( int coeff, int scale )
+{
+    double val = coeff;
+    while ( scale-- > 0 )
+        val /= 10.0;
+    return val;
+}
+
+/* pwrtbl[( v * ( exponent + 1 ) + e ) * EVAL_BLOCK + p] == ( c_v * x_v )^e
+ * for point p in the block, the points are stored per variable as well:
+ * points[v * EVAL_BLOCK + p] == x_v */
+static void mk_pwrtbl( int nr_vars, int exponent, const double *points,
+                       const double *coeffs, double *pwrtbl )
+{
+    for ( int v = 0; v < nr_vars; v++ ) {
+        double *row = pwrtbl + ( v * ( exponent + 1 ) ) * EVAL_BLOCK;
+        for ( int p = 0; p < EVAL_BLOCK; p++ )
+            row[p] = 1.0;
+        for ( int e = 1; e <= exponent; e++ ) {
+            double *restrict cur = row + e * EVAL_BLOCK;
+            const double *restrict prev = row + ( e - 1 ) * EVAL_BLOCK;
+            const double *restrict x = points + v * EVAL_BLOCK;
+            for ( int p = 0; p < EVAL_BLOCK; p++ )
+                cur[p] = prev[p] * ( coeffs[v] * x[p] );
+        }
+    }
+}
+
+/* The multinomial coeffecient of a row, from the last column, or from
+ * lgamma() when it was too big for the table. */
+static double row_mnom_double( int nr_vars, int exponent, int *row )
+{
+    if ( row[nr_vars] != MNOM_TOO_BIG )
+        return row[nr_vars];
+
+    double log_mnom = lgamma( exponent + 1.0 );
+    for ( int v = 0; v < nr_vars; v++ )
+        log_mnom -= lgamma( row[v] + 1.0 );
+    return round( exp( log_mnom ) );
+}
+
+/* Sums up every term of the expansion for the points in the block. */
+static void eval_block( int terms_rows, int nr_vars, int exponent, int *terms_table,
+                        const double *pwrtbl, double *restrict result )
+{
+    double term[EVAL_BLOCK];
+
+    for ( int p = 0; p < EVAL_BLOCK; p++ )
+        result[p] = 0.0;
+
+    for ( int i = 0; i < terms_rows; i++ ) {
+        int *row = terms_table + ( i * ( nr_vars + 1 ) );
+        double mnom_coeff = row_mnom_double( nr_vars, exponent, row );
+
+        for ( int p = 0; p < EVAL_BLOCK; p++ )
+            term[p] = mnom_coeff;
+        for ( int v = 0; v < nr_vars; v++ ) {
+            if ( row[v] == 0 )
+                continue;
+            const double *restrict pwr = pwrtbl + ( v * ( exponent + 1 ) + row[v] ) * EVAL_BLOCK;
+            for ( int p = 0; p < EVAL_BLOCK; p++ )
+                term[p] *= pwr[p];
+        }
+        for ( int p = 0; p < EVAL_BLOCK; p++ )
+            result[p] += term[p];
+    }
+}
+
+/* Evaluates the multinomial as it was given, (c1x1 + c2x2 + ...)^n, and
+ * compares it with the value of the expansion.
+ * Returns false if they differ. */
+static bool check_point( int nr_vars, int exponent, const double *points, int p, const double *coeffs,
+                         double expanded, long lineno )
+{
+    double sum = 0.0,
+        abs_sum = 0.0;
+
+    for ( int v = 0; v < nr_vars; v++ ) {
+        sum += coeffs[v] * points[v * EVAL_BLOCK + p];
+        abs_sum += fabs( coeffs[v] * points[v * EVAL_BLOCK + p] );
+    }
+    double direct = pow( sum, exponent );
+    double bound = pow( abs_sum, exponent );
+
+    if ( fabs( expanded - direct ) > EVAL_TOLERANCE * bound ) {
+        fprintf( stderr, "eval_points: line %ld: expansion gives %.17g, but (...)^%d gives %.17g\n",
+                 lineno, expanded, exponent, direct );
+        return false;
+    }
+    return true;
+}
+
+/* The memory eval_points() needs, besides the terms table. */
+double eval_memory( int nr_vars, int exponent )
+{
+    return ( double ) nr_vars * ( ( exponent + 1.0 ) * EVAL_BLOCK + EVAL_BLOCK + 1.0 ) * sizeof( double );
+}
+
+/**
+ * @brief Reads points from fp, and prints the value of the expansion, one
+ * value per line.
+ * @detail
+ * The coefftbl must have been adjusted for the operators with
+ * adjust_coeffs() first. If check is true, then every value is compared
+ * with the value of the expression before it was expanded.
+ * Returns 0, or -1 if any of the checks failed, or on a bad input line.
+ */
+int eval_points( FILE *fp, int terms_rows, int nr_vars, int exponent, int *terms_table,
+                 int *coefftbl, int *scaletbl, bool check )
+{
+    double *coeffs = malloc( nr_vars * sizeof( double ) );
+    double *points = calloc( EVAL_BLOCK * nr_vars, sizeof( double ) );
+    double *pwrtbl = malloc( nr_vars * ( exponent + 1 ) * EVAL_BLOCK * sizeof( double ) );
+    double result[EVAL_BLOCK];
+    if ( coeffs == NULL || points == NULL || pwrtbl == NULL ) {
+        fprintf( stderr, "eval_points: Out of memory, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
+    for ( int v = 0; v < nr_vars; v++ )
+        coeffs[v] = coeff2double( coefftbl[v], scaletbl[v] );
+
+    char *line = NULL;
+    size_t linecap = 0;
+    long lineno = 0,
+        linenos[EVAL_BLOCK];
+    int nr_pts = 0,
+        ret_val = 0;
+    bool at_eof = false,
+        bad_line = false;       /* stops the reading, like the end */
+
+    while ( !at_eof ) {
+        if ( getline( &line, &linecap, fp ) == -1 ) {
+            at_eof = true;
+        } else {
+            char *p = line, *endptr;
+            int v = 0;
+
+            lineno++;
+            while ( *p == ' ' || *p == '\t' )
+                p++;
+            if ( *p == '\n' || *p == '\0' )
+                continue;
+            for ( v = 0; v < nr_vars; v++ ) {
+                errno = 0;
+                points[v * EVAL_BLOCK + nr_pts] = strtod( p, &endptr );
+                if ( endptr == p || errno != 0 )
+                    break;
+                p = endptr;
+            }
+            p += strspn( p, " \t\n" );
+            if ( v < nr_vars || *p != '\0' ) {
+                bad_line = true;
+                at_eof = true; /* but the points before it are still evaluated */
+            } else {
+                linenos[nr_pts++] = lineno;
+            }
+        }
+        if ( nr_pts == EVAL_BLOCK || ( at_eof && nr_pts > 0 ) ) {
+            mk_pwrtbl( nr_vars, exponent, points, coeffs, pwrtbl );
+            eval_block( terms_rows, nr_vars, exponent, terms_table, pwrtbl, result );
+            for ( int p = 0; p < nr_pts; p++ ) {
+                printf( "%.17g\n", result[p] );
+                if ( check && !check_point( nr_vars, exponent, points, p, coeffs,
+                                            result[p], linenos[p] ) ) {
+                    ret_val = -1;
+                }
+            }
+            nr_pts = 0;
+        }
+    }
+    if ( bad_line ) {
+        fflush( stdout );
+        fprintf( stderr, "eval_points: line %ld: expected %d numbers, one for each variable.\n",
+                 lineno, nr_vars );
+        ret_val = -1;
+    }
+    free( line );
+    free( pwrtbl );
+    free( points );
+    free( coeffs );
+    return ret_val;
+}
@@ -22,44 +22,84 @@
  * GNU LPGL 3.0
  */
 
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include "multinom.h"
 
-/* we get the product of coeffecients which we multiply with the multnomial 
- * coeffecient.
+/*
+ * The coeffecient of a term is the multinomial coeffecient times the
+ * coeffecients of the variables raised to their powers in the term. Before
+ * we expand, coeff_width() tells us the width of the integers that are
+ * needed for the biggest of them, and we expand with the kernel for that
+ * width: long, __int128, or the bignums in bignum.c. Then nothing can
+ * overflow, and there are no checks in the loops over the rows.
+ *
+ * When some of the variables have the same coeffecient, the whole
+ * coeffecients repeats, and the __int128 and bignum kernels computes them
+ * once for every class of terms in partcache.c. Otherwise, and for longs,
+ * that are computed a block of terms at the time, just the multinomial
+ * coeffecients that didn't fit in the table are cached.
+ *
+ * --approx doesn't compute the coeffecients, but their log10, from the
+ * log10 of the factorials, and of the coeffecients of the variables, in
+ * doubles, so it is as fast for any exponent, and the sign from the odd
+ * powers of the negative coeffecients. They are printed like 1.234567890e+4321,
+ * with 10 digits, which is about what is left of a double after the
+ * logarithms, when the exponent is big.
  */
-static int calc_cur_factor_coeff( int nr_vars, int *terms_table, int *coefftbl )
+
+#define APPROX_DIGITS 10        /* significant digits of --approx */
+
+/* Sets up the cache for the whole coeffecients of the terms, when there is
+ * any classes of variables with the same coeffecient, and returns true,
+ * otherwise for the multinomial coeffecients. */
+static bool setup_cache( partCache *pc, int nr_vars, int *coefftbl, size_t term_size, size_t mnom_size )
 {
-   /* We get the multnomial coeffecient from last column */
-    int factor_coeff = terms_table[nr_vars]; // 
-   /* compounds the product of it, and individual coeffe per variable, raised
-      to the correct power for thiss term. */
-    for ( int i = 0; i < nr_vars; i++ ) {
-        if ( terms_table[i] > 0 ) {
-            if ( coefftbl[i] != 0 && coefftbl[i] != 1 ) {
-                factor_coeff *= power( coefftbl[i], terms_table[i] );
-            }
-        }
+    pc_init( pc, nr_vars, coefftbl, term_size );
+    if ( pc->nr_classes < nr_vars )
+        return true;
+    pc_free( pc );
+    pc_init( pc, nr_vars, NULL, mnom_size );
+    return false;
+}
+
+/* The multinomial coeffecient of a row, from the last column, or computed
+ * by binomial steps, like c() in permtable.c, when it didn't fit in an int,
+ * then it is looked up in mnom_pc first, unless that is NULL. */
+static long row_mnom_long( int nr_vars, int exponent, int *row, partCache *mnom_pc )
+{
+    if ( row[nr_vars] != MNOM_TOO_BIG )
+        return row[nr_vars];
+
+    bool is_new = true;
+    long *cached = ( mnom_pc != NULL ) ? pc_find( mnom_pc, row, &is_new ) : NULL;
+    if ( !is_new )
+        return *cached;
+
+    long mnom = 1;
+    int left = exponent;
+    for ( int j = 0; j < nr_vars; j++ ) {
+        for ( int m = 1; m <= row[j]; m++ )
+            mnom = mnom * ( left - m + 1 ) / m;
+        left -= row[j];
     }
-    return factor_coeff;
+    if ( cached != NULL )
+        *cached = mnom;
+    return mnom;
 }
 
-/* Prints variables raised to a power, like we expect:
- * example:
- *      xy^2z^3
+/* The number of decimals in the coeffecient of a term, is the sum of the
+ * decimals of every coeffecient, times the power it is raised to.
  */
-static void print_raised_vars( int nr_vars, int *terms_table, char *vartable )
+static int calc_cur_factor_scale( int nr_vars, int *terms_table, int *scaletbl )
 {
+    int factor_scale = 0;
     for ( int i = 0; i < nr_vars; i++ ) {
-        if ( terms_table[i] > 0 ) {
-           // we will include this in the factor
-            if ( terms_table[i] == 1 ) {
-                printf( "%c", vartable[i] );
-            } else if ( terms_table[i] > 1 ) {
-                printf( "%c^%d", vartable[i], terms_table[i] );
-            }
-        }
+        factor_scale += scaletbl[i] * terms_table[i];
     }
+    return factor_scale;
 }
 
 /* we adjust any signs of coeffecients when we have a 
@@ -74,26 +114,512 @@ void adjust_coeffs( int nr_vars, int *coefftbl, char *optbl )
     }
 }
 
-/* Every row in the terms table becomes one factor in the expanded
- * multnomial. */
-void expand_expr( int terms_rows, int nr_vars, int *terms_table, char *vartable, int *coefftbl )
+/* What the kernels needs to expand the rows, the same for every worker. */
+typedef struct {
+    int nr_vars, exponent;
+    int *terms_table, *coefftbl, *scaletbl;
+    arith_width width;
+    termSink *out;
+    long first;             /* the terms out had, before the rows */
+    double *logtbl;         /* W_LOG: log10 of 0!..n!, of |c_v|, and of the
+                               divisor of --prob */
+} expandJob;
+
+/* The state of a kernel, every worker has its own. */
+typedef struct {
+    void *pwrtbl;           /* c_v^e, in longs, or __int128s */
+    int *block_exps;        /* the powers of a block of expand_long() */
+    partCache pc;
+    bool whole;             /* pc has whole coeffecients, not multinomials */
+    bigNum factor_coeff;
+    primeTerm pt;
+    bool primes;
+} expandState;
+
+/* The terms a block at the time: the multinomial coeffecients and the
+ * powers, column by column, go to coeff_block_long() in coeffsimd.c, that
+ * multiplies them with the powers of the coeffecients, for many terms at
+ * once. That is cheaper than looking up the whole coeffecient, so the cache
+ * is just for the multinomials that didn't fit in the table. */
+static void expand_long( expandJob *job, expandState *st, long lo, long hi, termSink *out )
+{
+    int nr_vars = job->nr_vars,
+        exponent = job->exponent,
+       *exps = st->block_exps;
+    long coeffs[COEFF_BLOCK];
+
+    for ( long b = lo; b < hi; b += COEFF_BLOCK ) {
+        int nr_terms = ( hi - b < COEFF_BLOCK ) ? ( int ) ( hi - b ) : COEFF_BLOCK;
+        int *rows = job->terms_table + ( b * ( nr_vars + 1 ) );
+
+        for ( int j = 0; j < nr_terms; j++ ) {
+            int *row = rows + j * ( nr_vars + 1 );
+            coeffs[j] = row_mnom_long( nr_vars, exponent, row, &st->pc );
+            for ( int v = 0; v < nr_vars; v++ )
+                exps[v * COEFF_BLOCK + j] = row[v];
+        }
+        coeff_block_long( nr_vars, exponent, nr_terms, st->pwrtbl, exps, coeffs );
+        for ( int j = 0; j < nr_terms; j++ ) {
+            int *row = rows + j * ( nr_vars + 1 );
+            sink_term_long( out, coeffs[j], calc_cur_factor_scale( nr_vars, row, job->scaletbl ), row );
+        }
+    }
+}
+
+#ifdef __SIZEOF_INT128__
+/* The decimal digits of |val|, in buf, that must hold 40 chars. */
+static char *int128_to_digits( __int128 val, char *buf )
+{
+    unsigned __int128 mag = ( val < 0 ) ? -( unsigned __int128 ) val : ( unsigned __int128 ) val;
+    char *p = buf + 40;
+    *--p = '\0';
+    do {
+        *--p = '0' + ( int ) ( mag % 10 );
+        mag /= 10;
+    } while ( mag > 0 );
+    return p;
+}
+
+static void expand_int128( expandJob *job, expandState *st, long lo, long hi, termSink *out )
+{
+    char buf[40];
+    int nr_vars = job->nr_vars,
+        exponent = job->exponent;
+    __int128 *pwrtbl = st->pwrtbl;
+
+    for ( long i = lo; i < hi; i++ ) {
+        int *row = job->terms_table + ( i * ( nr_vars + 1 ) );
+        bool is_new = true;
+        __int128 *cached = st->whole ? pc_find( &st->pc, row, &is_new ) : NULL,
+            factor_coeff = 1;
+        if ( !is_new ) {
+            factor_coeff = *cached;
+        } else {
+            if ( row[nr_vars] != MNOM_TOO_BIG ) {
+                factor_coeff = row[nr_vars];
+            } else {
+                bool mnom_new = true;
+                __int128 *mnom = st->whole ? NULL : pc_find( &st->pc, row, &mnom_new );
+                if ( !mnom_new ) {
+                    factor_coeff = *mnom;
+                } else {
+                    int left = exponent;
+                    for ( int j = 0; j < nr_vars; j++ ) {
+                        for ( int m = 1; m <= row[j]; m++ )
+                            factor_coeff = factor_coeff * ( left - m + 1 ) / m;
+                        left -= row[j];
+                    }
+                    if ( mnom != NULL )
+                        *mnom = factor_coeff;
+                }
+            }
+            for ( int v = 0; v < nr_vars; v++ )
+                factor_coeff *= pwrtbl[v * ( exponent + 1 ) + row[v]];
+            if ( cached != NULL )
+                *cached = factor_coeff;
+        }
+
+        if ( out->stats != NULL ) {
+            big_set_int128( &st->factor_coeff, factor_coeff );
+            sink_term_big( out, &st->factor_coeff, calc_cur_factor_scale( nr_vars, row, job->scaletbl ), row );
+        } else {
+            sink_term( out, factor_coeff < 0, int128_to_digits( factor_coeff, buf ),
+                       calc_cur_factor_scale( nr_vars, row, job->scaletbl ), row );
+        }
+    }
+}
+#endif
+
+/* A whole coeffecient in the cache of expand_big(). */
+typedef struct {
+    char *digits;
+    bool neg;
+} bigTerm;
+
+/* Too big for anything else, we multiply up the coeffecient from scratch
+ * for every term, or every class of terms, the time goes to the big numbers
+ * anyway. The bound from the estimate sizes the limbs once, so they never
+ * grow while we expand. From PF_MIN_EXPONENT, the coeffecients are products
+ * of primes, from primefact.c. */
+static void expand_big( expandJob *job, expandState *st, long lo, long hi, termSink *out )
 {
+    int nr_vars = job->nr_vars,
+        exponent = job->exponent,
+       *coefftbl = job->coefftbl;
+    bigNum *factor_coeff = &st->factor_coeff;
 
-    for ( int i = 0; i < terms_rows; i++ ) {
+    for ( long i = lo; i < hi; i++ ) {
+        int *row = job->terms_table + ( i * ( nr_vars + 1 ) );
+        bool is_new = true;
+        bigTerm *cached = ( st->whole && out->stats == NULL ) ? pc_find( &st->pc, row, &is_new ) : NULL;
+        if ( !is_new ) {
+            sink_term( out, cached->neg, cached->digits, calc_cur_factor_scale( nr_vars, row, job->scaletbl ), row );
+            continue;
+        }
 
-        int factor_coeff = calc_cur_factor_coeff( nr_vars,
-                                                  ( terms_table + ( i * ( nr_vars + 1 ) ) ), coefftbl );
+        if ( st->primes ) {
+            pf_move_to( &st->pt, row );
+            pf_value( &st->pt, factor_coeff );
+        } else {
+            bool mnom_new = true;
+            bigNum *mnom = st->whole ? NULL : pc_find( &st->pc, row, &mnom_new );
+            if ( !mnom_new ) {
+                big_copy( factor_coeff, mnom );
+            } else {
+                int left = exponent;
+                big_set( factor_coeff, 1L );
+                for ( int j = 0; j < nr_vars; j++ ) {
+                    for ( int m = 1; m <= row[j]; m++ ) {
+                        big_mul_small( factor_coeff, left - m + 1 );
+                        big_div_small( factor_coeff, m );
+                    }
+                    left -= row[j];
+                }
+                if ( mnom != NULL ) {
+                    big_init( mnom );
+                    big_copy( mnom, factor_coeff );
+                }
+            }
+            for ( int v = 0; v < nr_vars; v++ ) {
+                if ( coefftbl[v] == 1 )
+                    continue;
+                for ( int e = 0; e < row[v]; e++ )
+                    big_mul_small( factor_coeff, coefftbl[v] );
+            }
+        }
 
-        if ( i == 0 ) {
-            printf( "%d", factor_coeff );
-        } else if ( factor_coeff < 0 ) {
-            printf( " - " );
-            factor_coeff *= -1;
-            printf( "%d", factor_coeff );
+        if ( out->stats != NULL ) {
+            sink_term_big( out, factor_coeff, calc_cur_factor_scale( nr_vars, row, job->scaletbl ), row );
+            continue;
+        }
+        char *digits = big_to_digits( factor_coeff );
+        bool neg = factor_coeff->neg && !big_is_zero( factor_coeff );
+        sink_term( out, neg, digits, calc_cur_factor_scale( nr_vars, row, job->scaletbl ), row );
+        if ( cached != NULL ) {
+            cached->digits = digits;
+            cached->neg = neg;
         } else {
-            printf( " + %d", factor_coeff );
+            free( digits );
+        }
+    }
+}
+
+/* The coeffecient 10^lg as m.mmmmmmmmme+x, the mantissa from the fraction
+ * of lg, so it doesn't overflow, however big it is. */
+static void log10_digits( double lg, char *buf, size_t size )
+{
+    double e = floor( lg ),
+        m = pow( 10.0, lg - e );
+    if ( m >= 10.0 - 0.5e-9 ) {
+       /* it rounds up to 10 */
+        m /= 10.0;
+        e += 1.0;
+    }
+    snprintf( buf, size, "%.*fe%+.0f", APPROX_DIGITS - 1, m, e );
+}
+
+/* The log10 of the coeffecient of every term, from the tables in the job:
+ * log(n!) - log(e_1!) - ... + e_1 log|c_1| + ..., a term with a power of a
+ * 0 coeffecient is 0. */
+static void expand_log( expandJob *job, long lo, long hi, termSink *out )
+{
+    int nr_vars = job->nr_vars,
+        exponent = job->exponent;
+    const double *lfact = job->logtbl,
+        *lcoeff = lfact + exponent + 1;
+    double base = lcoeff[nr_vars];
+    char digits[64];
+
+    for ( long r = lo; r < hi; r++ ) {
+        int *row = job->terms_table + r * ( nr_vars + 1 );
+        double lg = base;
+        bool neg = false,
+            zero = false;
+
+        for ( int v = 0; v < nr_vars; v++ ) {
+            if ( row[v] == 0 )
+                continue;
+            zero |= ( job->coefftbl[v] == 0 );
+            neg ^= ( job->coefftbl[v] < 0 && row[v] % 2 == 1 );
+            lg += row[v] * lcoeff[v] - lfact[row[v]];
+        }
+        if ( zero ) {
+            sink_term( out, false, "0", 0, row );
+        } else {
+            log10_digits( lg, digits, sizeof( digits ) );
+            sink_term( out, neg, digits, 0, row );
+        }
+    }
+}
+
+/* The tables of expand_log(), made once, lgamma() isn't thread safe. */
+static double *mk_logtbl( int nr_vars, int exponent, int *coefftbl, int *scaletbl )
+{
+    double *logtbl = malloc( ( exponent + nr_vars + 2 ) * sizeof( double ) ),
+        *lcoeff = logtbl + exponent + 1,
+        abs_sum = 0.0;
+    if ( logtbl == NULL ) {
+        expand_fail( "expand_log: Out of memory\n" );
+    }
+    for ( int e = 0; e <= exponent; e++ )
+        logtbl[e] = lgamma( e + 1.0 ) / M_LN10;
+    for ( int v = 0; v < nr_vars; v++ ) {
+        double c = fabs( ( double ) coefftbl[v] ) / pow( 10.0, scaletbl[v] );
+        lcoeff[v] = ( c > 0.0 ) ? log10( c ) : 0.0;
+        abs_sum += c;
+    }
+   /* The coeffecients of (|c1| + |c2| + ...)^n adds up to 1 with --prob. */
+    lcoeff[nr_vars] = logtbl[exponent];
+    if ( APPROX_PROB && abs_sum > 0.0 )
+        lcoeff[nr_vars] -= exponent * log10( abs_sum );
+    return logtbl;
+}
+
+/* Makes the powers of the coeffecients, and the cache, for the width of the
+ * kernel. */
+static void *expand_init( void *ctx )
+{
+    expandJob *job = ctx;
+    int nr_vars = job->nr_vars,
+        exponent = job->exponent;
+    expandState *st = malloc( sizeof( expandState ) );
+    if ( st == NULL ) {
+        expand_fail( "expand_init: Out of memory\n" );
+    }
+    st->pwrtbl = NULL;
+    st->primes = false;
+
+    switch ( job->width ) {
+    case W_LOG:
+        break; /* the tables are in the job */
+    case W_LONG: {
+        long *pwrtbl = malloc( nr_vars * ( exponent + 1 ) * sizeof( long ) );
+        if ( pwrtbl == NULL ) {
+            expand_fail( "expand_long: Out of memory\n" );
+        }
+        for ( int v = 0; v < nr_vars; v++ ) {
+            long *pwr = pwrtbl + v * ( exponent + 1 );
+            pwr[0] = 1;
+            for ( int e = 1; e <= exponent; e++ )
+                pwr[e] = pwr[e - 1] * job->coefftbl[v];
+        }
+        st->pwrtbl = pwrtbl;
+        st->block_exps = malloc( nr_vars * COEFF_BLOCK * sizeof( int ) );
+        if ( st->block_exps == NULL ) {
+            expand_fail( "expand_long: Out of memory\n" );
+        }
+        pc_init( &st->pc, nr_vars, NULL, sizeof( long ) );
+        st->whole = false;
+        break;
+    }
+#ifdef __SIZEOF_INT128__
+    case W_INT128: {
+        __int128 *pwrtbl = malloc( nr_vars * ( exponent + 1 ) * sizeof( __int128 ) );
+        if ( pwrtbl == NULL ) {
+            expand_fail( "expand_int128: Out of memory\n" );
+        }
+        for ( int v = 0; v < nr_vars; v++ ) {
+            __int128 *pwr = pwrtbl + v * ( exponent + 1 );
+            pwr[0] = 1;
+            for ( int e = 1; e <= exponent; e++ )
+                pwr[e] = pwr[e - 1] * job->coefftbl[v];
+        }
+        st->pwrtbl = pwrtbl;
+        st->whole = setup_cache( &st->pc, nr_vars, job->coefftbl, sizeof( __int128 ), sizeof( __int128 ) );
+        big_init( &st->factor_coeff ); /* for --stats */
+        break;
+    }
+#endif
+    default:
+        big_init( &st->factor_coeff );
+        big_reserve( &st->factor_coeff, ( int ) coeff_bound_bits( nr_vars, exponent, job->coefftbl ) + 1 );
+        st->whole = setup_cache( &st->pc, nr_vars, job->coefftbl, sizeof( bigTerm ), sizeof( bigNum ) );
+        st->primes = ( exponent >= PF_MIN_EXPONENT );
+        if ( st->primes )
+            pf_init( &st->pt, nr_vars, exponent, job->coefftbl );
+    }
+    return st;
+}
+
+static void expand_fini( void *ctx, void *local )
+{
+    expandJob *job = ctx;
+    expandState *st = local;
+
+    if ( job->width == W_LOG ) {
+        free( st );
+        return;
+    }
+    if ( job->width == W_LONG ) {
+        free( st->block_exps );
+        free( st->pwrtbl );
+    } else if ( job->width == W_INT128 ) {
+        big_free( &st->factor_coeff );
+        free( st->pwrtbl );
+    } else {
+        for ( int id = 0; id < st->pc.nr_keys; id++ ) {
+            if ( st->whole )
+                free( ( ( bigTerm * ) pc_value( &st->pc, id ) )->digits );
+            else
+                big_free( pc_value( &st->pc, id ) );
+        }
+        if ( st->primes )
+            pf_free( &st->pt );
+        big_free( &st->factor_coeff );
+    }
+    pc_free( &st->pc );
+    free( st );
+}
+
+static void expand_rows( expandJob *job, expandState *st, long lo, long hi, termSink *out )
+{
+    switch ( job->width ) {
+    case W_LOG:
+        expand_log( job, lo, hi, out );
+        break;
+    case W_LONG:
+        expand_long( job, st, lo, hi, out );
+        break;
+#ifdef __SIZEOF_INT128__
+    case W_INT128:
+        expand_int128( job, st, lo, hi, out );
+        break;
+#endif
+    default:
+        expand_big( job, st, lo, hi, out );
+    }
+}
+
+/* A worker expands its rows into a part of the output, that is joined in
+ * the order of the rows. */
+static void expand_leaf( void *ctx, void *local, long lo, long hi, void **part )
+{
+    expandJob *job = ctx;
+    termSink *out = sink_part( job->out, job->first + lo );
+    TRACE( expand_chunk, lo, hi );
+    expand_rows( job, local, lo, hi, out );
+    *part = out;
+}
+
+static void expand_emit( void *ctx, void *part )
+{
+    expandJob *job = ctx;
+    sink_join( job->out, part );
+}
+
+static const wsOps expand_ops = { expand_init, expand_leaf, expand_emit, expand_fini };
+
+/* c^0, c^1, .. c^n */
+static long *long_powers( int coeff, int n )
+{
+    long *pwr = malloc( ( n + 1 ) * sizeof( long ) );
+    if ( pwr == NULL ) {
+        expand_fail( "long_powers: Out of memory\n" );
+    }
+    pwr[0] = 1;
+    for ( int e = 1; e <= n; e++ )
+        pwr[e] = pwr[e - 1] * coeff;
+    return pwr;
+}
+
+/* (a + b)^n: the binomial coeffecients of the row follows from each other,
+ * C(n,j+1) == C(n,j) * (n-j) / (j+1), exactly. */
+static void expand_binomial( int n, int *coefftbl, int *scaletbl, termSink *out )
+{
+    long *pa = long_powers( coefftbl[0], n ),
+        *pb = long_powers( coefftbl[1], n ),
+        binom = 1;
+    int exps[2];
+
+    for ( int j = 0; j <= n; j++ ) {
+        exps[0] = n - j;
+        exps[1] = j;
+        sink_term_long( out, binom * pa[n - j] * pb[j], scaletbl[0] * ( n - j ) + scaletbl[1] * j, exps );
+        binom = binom * ( n - j ) / ( j + 1 );
+    }
+    free( pb );
+    free( pa );
+}
+
+/* (a + b + c)^n: the multinomial coeffecient of a^i b^j c^m-j, where
+ * m == n-i, is C(n,m) * C(m,j). C(n,m) follows from the one before, like
+ * in expand_binomial(), and the C(m,j) are row m of Pascal's triangle,
+ * that is added up from row m-1 in place. */
+static void expand_trinomial( int n, int *coefftbl, int *scaletbl, termSink *out )
+{
+    long *pa = long_powers( coefftbl[0], n ),
+        *pb = long_powers( coefftbl[1], n ),
+        *pc = long_powers( coefftbl[2], n ),
+        *pascal = malloc( ( n + 1 ) * sizeof( long ) ),
+        binom = 1;
+    int exps[3];
+    if ( pascal == NULL ) {
+        expand_fail( "expand_trinomial: Out of memory\n" );
+    }
+
+    pascal[0] = 1;
+    for ( int m = 0; m <= n; m++ ) {
+        if ( m > 0 ) {
+            pascal[m] = 1;
+            for ( int j = m - 1; j > 0; j-- )
+                pascal[j] += pascal[j - 1];
         }
-        print_raised_vars( nr_vars, ( terms_table + ( i * ( nr_vars + 1 ) ) ), vartable );
+        long coeff_a = binom * pa[n - m];
+        int scale_a = scaletbl[0] * ( n - m );
+        exps[0] = n - m;
+        for ( int j = m; j >= 0; j-- ) {
+            exps[1] = j;
+            exps[2] = m - j;
+            sink_term_long( out, coeff_a * pascal[j] * pb[j] * pc[m - j],
+                            scale_a + scaletbl[1] * j + scaletbl[2] * ( m - j ), exps );
+        }
+        binom = binom * ( n - m ) / ( m + 1 );
+    }
+    free( pascal );
+    free( pc );
+    free( pb );
+    free( pa );
+}
+
+/**
+ * @brief Expands binomials and trinomials, whose coeffecients fits in a
+ * long, without a terms table, in the order of the table.
+ * @detail Returns false, and does nothing, for anything else.
+ */
+bool expand_small( int nr_vars, int exponent, int *coefftbl, int *scaletbl, termSink *out )
+{
+    if ( ( nr_vars != 2 && nr_vars != 3 ) || coeff_width( nr_vars, exponent, coefftbl ) != W_LONG )
+        return false;
+    if ( nr_vars == 2 )
+        expand_binomial( exponent, coefftbl, scaletbl, out );
+    else
+        expand_trinomial( exponent, coefftbl, scaletbl, out );
+    return true;
+}
+
+/* Every row in the terms table becomes one factor in the expanded
+ * multnomial, that goes to out, the caller closes it. A big table is
+ * expanded by the workers of worksteal.c. */
+void expand_expr( int terms_rows, int nr_vars, int exponent, int *terms_table, int *coefftbl, int *scaletbl,
+                  termSink *out )
+{
+    if ( terms_rows == 0 )
+        return; /* the bounds of -b left no terms. */
+
+    expandJob job = { nr_vars, exponent, terms_table, coefftbl, scaletbl,
+        APPROX_MODE ? W_LOG : coeff_width( nr_vars, exponent, coefftbl ), out, out->nr_terms, NULL };
+    if ( job.width == W_LOG )
+        job.logtbl = mk_logtbl( nr_vars, exponent, coefftbl, scaletbl );
+    int nr_threads = ws_threads( terms_rows );
+
+    TRACE( expand_start, nr_vars, exponent, terms_rows, nr_threads );
+    if ( nr_threads > 1 ) {
+        ws_run( terms_rows, ws_grain( terms_rows, nr_threads ), nr_threads, &expand_ops, &job );
+    } else {
+        expandState *st = expand_init( &job );
+        expand_rows( &job, st, 0, terms_rows, out );
+        expand_fini( &job, st );
     }
-    printf( "\n" );
+    free( job.logtbl );
+    TRACE( expand_done, nr_vars, exponent, terms_rows, out->bytes ); /* bytes of out so far */
 }
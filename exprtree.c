@@ -0,0 +1,745 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include "multinom.h"
+/*
+ * exprtree.c
+ * ==========
+ *
+ * Nested expressions, like ((a + b)^2 - c)^3, that the flat grammar of
+ * finitestate.c can't take. They are parsed by recursive descent into a
+ * tree, that is expanded bottom up, every node into a sparse polynomial:
+ *
+ *  sum     := [+|-] product { (+|-) product }
+ *  product := [number] { factor }, at least one of them
+ *  factor  := letter [^power] | '(' sum ')' [^power]
+ *
+ * Factors after each other are multiplied, so 2a(b + c)^2 is a product.
+ * The nodes are hash consed: every node has a key made from its kind and
+ * the ids of its children, and a node with the same key as one we already
+ * have, is that node, so identical subexpressions are the same node, and
+ * are expanded once. The children of sums and products are sorted by id in
+ * the key, so a + b and b + a are the same too.
+ *
+ * A power of a sum is expanded by the multinomial theorem, over the terms of
+ * the sum, with the compositions and multinomial coeffecients of
+ * mk_permtable(), and the like terms of the result are added up, in a
+ * partCache, where every variable has a class of its own, so the key of a
+ * term is its powers. The coeffecients are bignums, with a scale of
+ * decimals of their own. The terms that adds up to 0 are left out.
+ */
+
+typedef enum { N_CONST, N_VAR, N_SUM, N_PRODUCT, N_POWER } nodeKind;
+
+/* A sparse polynomial, in the variables of the whole expression. */
+typedef struct {
+    int nr_vars;
+    int nr_terms, cap;
+    int *exps;                  /* nr_vars powers per term */
+    bigNum *coeffs;
+    int *scales;
+    partCache pc;               /* the term of the powers, while adding */
+} sparsePoly;
+
+typedef struct {
+    nodeKind kind;
+    int val;                    /* N_CONST: the digits, N_VAR: the variable,
+                                   N_POWER: the exponent */
+    int scale;                  /* N_CONST: the decimals */
+    int nr_kids;
+    int *kids;                  /* ids of the nodes */
+    char *signs;                /* N_SUM: '+' or '-', for every kid */
+    char *key;
+    sparsePoly *poly;           /* the expansion, once it is made */
+} treeNode;
+
+typedef struct {
+    const char *line;
+    int pos;
+    char vars[2 * 26 + 1];
+    int nr_vars;
+    treeNode *nodes;
+    int nr_nodes, cap_nodes;
+    int *slots;                 /* the hash table of the keys, with ids */
+    int nr_slots;
+    int nr_shared;              /* subexpressions that were there already */
+} exprTree;
+
+#define TREE_EMPTY -1
+
+static void *tree_alloc( void *ptr, size_t size )
+{
+    void *res = realloc( ptr, size );
+    if ( res == NULL ) {
+        expand_fail( "exprtree: Out of memory\n" );
+    }
+    return res;
+}
+
+/* FNV-1a over the key. */
+static unsigned long key_hash( const char *key )
+{
+    unsigned long h = 14695981039346656037UL;
+    for ( ; *key != '\0'; key++ ) {
+        h ^= ( unsigned char ) *key;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static void tree_rehash( exprTree *tree )
+{
+    free( tree->slots );
+    tree->nr_slots = ( tree->nr_slots == 0 ) ? 64 : 2 * tree->nr_slots;
+    tree->slots = tree_alloc( NULL, tree->nr_slots * sizeof( int ) );
+    for ( int s = 0; s < tree->nr_slots; s++ )
+        tree->slots[s] = TREE_EMPTY;
+    for ( int id = 0; id < tree->nr_nodes; id++ ) {
+        unsigned long s = key_hash( tree->nodes[id].key ) & ( tree->nr_slots - 1 );
+        while ( tree->slots[s] != TREE_EMPTY )
+            s = ( s + 1 ) & ( tree->nr_slots - 1 );
+        tree->slots[s] = id;
+    }
+}
+
+static int cmp_int( const void *a, const void *b )
+{
+    int x = *( const int * ) a,
+        y = *( const int * ) b;
+    return ( x > y ) - ( x < y );
+}
+
+/* The id of the node, that is a new one, unless there was one with the same
+ * key already, then node is freed. */
+static int intern( exprTree *tree, treeNode *node )
+{
+    size_t len = 32 + 16 * ( size_t ) node->nr_kids,
+        used;
+    char *key = tree_alloc( NULL, len );
+
+    switch ( node->kind ) {
+    case N_CONST:
+        used = snprintf( key, len, "c%d.%d", node->val, node->scale );
+        break;
+    case N_VAR:
+        used = snprintf( key, len, "v%d", node->val );
+        break;
+    case N_POWER:
+        used = snprintf( key, len, "p%d^%d", node->kids[0], node->val );
+        break;
+    default:
+       /* A sum keeps the signs with the kids, as -id or +id. */
+        used = snprintf( key, len, "%c", ( node->kind == N_SUM ) ? 's' : 'm' );
+        int *ids = tree_alloc( NULL, node->nr_kids * sizeof( int ) );
+        for ( int i = 0; i < node->nr_kids; i++ )
+            ids[i] = ( node->signs != NULL && node->signs[i] == MINUS ) ? -node->kids[i] - 1 : node->kids[i];
+        qsort( ids, node->nr_kids, sizeof( int ), cmp_int );
+        for ( int i = 0; i < node->nr_kids; i++ )
+            used += snprintf( key + used, len - used, ",%d", ids[i] );
+        free( ids );
+    }
+    node->key = key;
+
+    if ( 2 * ( tree->nr_nodes + 1 ) > tree->nr_slots )
+        tree_rehash( tree );
+    unsigned long s = key_hash( key ) & ( tree->nr_slots - 1 );
+    while ( tree->slots[s] != TREE_EMPTY ) {
+        int id = tree->slots[s];
+        if ( strcmp( tree->nodes[id].key, key ) == 0 ) {
+            free( node->kids );
+            free( node->signs );
+            free( key );
+            tree->nr_shared++;
+            return id;
+        }
+        s = ( s + 1 ) & ( tree->nr_slots - 1 );
+    }
+    if ( tree->nr_nodes == tree->cap_nodes ) {
+        tree->cap_nodes = ( tree->cap_nodes == 0 ) ? 16 : 2 * tree->cap_nodes;
+        tree->nodes = tree_alloc( tree->nodes, tree->cap_nodes * sizeof( treeNode ) );
+    }
+    node->poly = NULL;
+    tree->nodes[tree->nr_nodes] = *node;
+    tree->slots[s] = tree->nr_nodes;
+    return tree->nr_nodes++;
+}
+
+static int leaf( exprTree *tree, nodeKind kind, int val, int scale )
+{
+    treeNode node = { kind, val, scale, 0, NULL, NULL, NULL, NULL };
+    return intern( tree, &node );
+}
+
+/* A sum or product of the kids, or the kid, when there is just one. */
+static int branch( exprTree *tree, nodeKind kind, int nr_kids, int *kids, char *signs )
+{
+    if ( nr_kids == 1 && ( signs == NULL || signs[0] == PLUS ) ) {
+        int id = kids[0];
+        free( kids );
+        free( signs );
+        return id;
+    }
+    treeNode node = { kind, 0, 0, nr_kids, kids, signs, NULL, NULL };
+    return intern( tree, &node );
+}
+
+/* Points out the syntax error at the position we are at, like the flat
+ * grammar does. */
+static int tree_error( exprTree *tree, const char *details )
+{
+    consumed_text = tree->pos;
+    ignored_spaces = 0;
+    syntax_err( details );
+    return -1;
+}
+
+static void skip_spaces( exprTree *tree )
+{
+    while ( tree->line[tree->pos] == ' ' || tree->line[tree->pos] == '\t' )
+        tree->pos++;
+}
+
+/* digits[.digits] or .digits, as a scaled integer. */
+static int parse_number( exprTree *tree )
+{
+    const char *p = tree->line;
+    long val = 0;
+    int scale = 0;
+    bool point = false;
+
+    while ( isdigit( ( unsigned char ) p[tree->pos] ) || ( p[tree->pos] == '.' && !point ) ) {
+        if ( p[tree->pos] == '.' ) {
+            point = true;
+        } else {
+            val = val * 10 + ( p[tree->pos] - '0' );
+            scale += point;
+            if ( val > INT_MAX )
+                return tree_error( tree, "Value greater than INT_MAX!" );
+        }
+        tree->pos++;
+    }
+    if ( point && scale == 0 )
+        return tree_error( tree, "Expected a digit after the '.'" );
+    return leaf( tree, N_CONST, ( int ) val, scale );
+}
+
+static int parse_sum( exprTree *tree );
+
+/* A variable or a parenthesis, raised to a power or not. */
+static int parse_factor( exprTree *tree )
+{
+    char c = tree->line[tree->pos];
+    int id;
+
+    if ( isalpha( ( unsigned char ) c ) ) {
+        char *var = strchr( tree->vars, c );
+        if ( var == NULL ) {
+            tree->vars[tree->nr_vars++] = c;
+            var = tree->vars + tree->nr_vars - 1;
+        }
+        tree->pos++;
+        id = leaf( tree, N_VAR, ( int ) ( var - tree->vars ), 0 );
+    } else {
+        tree->pos++; /* '(' */
+        if ( ( id = parse_sum( tree ) ) == -1 )
+            return -1;
+        skip_spaces( tree );
+        if ( tree->line[tree->pos] != PRIGHT )
+            return tree_error( tree, "Expected a ')'" );
+        tree->pos++;
+    }
+    skip_spaces( tree );
+    if ( tree->line[tree->pos] != '^' )
+        return id;
+    tree->pos++;
+    skip_spaces( tree );
+    if ( !isdigit( ( unsigned char ) tree->line[tree->pos] ) )
+        return tree_error( tree, "Expected the power after the '^'" );
+    long power = 0;
+    while ( isdigit( ( unsigned char ) tree->line[tree->pos] ) ) {
+        power = power * 10 + ( tree->line[tree->pos++] - '0' );
+        if ( power > INT_MAX )
+            return tree_error( tree, "Power greater than INT_MAX!" );
+    }
+    int *kids = tree_alloc( NULL, sizeof( int ) );
+    kids[0] = id;
+    treeNode node = { N_POWER, ( int ) power, 0, 1, kids, NULL, NULL, NULL };
+    return intern( tree, &node );
+}
+
+static int parse_product( exprTree *tree )
+{
+    int nr_kids = 0,
+       *kids = NULL;
+
+    for ( ;; ) {
+        skip_spaces( tree );
+        char c = tree->line[tree->pos];
+        int id;
+        if ( nr_kids == 0 && ( isdigit( ( unsigned char ) c ) || c == '.' ) ) {
+            id = parse_number( tree );
+        } else if ( isalpha( ( unsigned char ) c ) || c == PLEFT ) {
+            id = parse_factor( tree );
+        } else if ( nr_kids == 0 ) {
+            id = tree_error( tree, "Expected a number, a variable or a '('" );
+        } else {
+            break;
+        }
+        if ( id == -1 ) {
+            free( kids );
+            return -1;
+        }
+        kids = tree_alloc( kids, ( nr_kids + 1 ) * sizeof( int ) );
+        kids[nr_kids++] = id;
+    }
+    return branch( tree, N_PRODUCT, nr_kids, kids, NULL );
+}
+
+static int parse_sum( exprTree *tree )
+{
+    int nr_kids = 0,
+       *kids = NULL;
+    char *signs = NULL,
+        sign = PLUS;
+
+    skip_spaces( tree );
+    if ( tree->line[tree->pos] == MINUS || tree->line[tree->pos] == PLUS )
+        sign = tree->line[tree->pos++];
+    for ( ;; ) {
+        int id = parse_product( tree );
+        if ( id == -1 ) {
+            free( kids );
+            free( signs );
+            return -1;
+        }
+        kids = tree_alloc( kids, ( nr_kids + 1 ) * sizeof( int ) );
+        signs = tree_alloc( signs, nr_kids + 1 );
+        kids[nr_kids] = id;
+        signs[nr_kids++] = sign;
+        skip_spaces( tree );
+        if ( tree->line[tree->pos] != MINUS && tree->line[tree->pos] != PLUS )
+            break;
+        sign = tree->line[tree->pos++];
+    }
+    return branch( tree, N_SUM, nr_kids, kids, signs );
+}
+
+static void poly_init( sparsePoly *poly, int nr_vars )
+{
+    int *classes = tree_alloc( NULL, ( nr_vars + 1 ) * sizeof( int ) );
+    for ( int v = 0; v < nr_vars; v++ )
+        classes[v] = v; /* every variable a class of its own */
+    poly->nr_vars = nr_vars;
+    poly->nr_terms = 0;
+    poly->cap = 0;
+    poly->exps = NULL;
+    poly->coeffs = NULL;
+    poly->scales = NULL;
+    pc_init( &poly->pc, nr_vars, classes, sizeof( int ) );
+    free( classes );
+}
+
+static void poly_free( sparsePoly *poly )
+{
+    for ( int t = 0; t < poly->nr_terms; t++ )
+        big_free( &poly->coeffs[t] );
+    pc_free( &poly->pc );
+    free( poly->scales );
+    free( poly->coeffs );
+    free( poly->exps );
+}
+
+/* coeff * 10^scale * 10^-scale, with scale more decimals. */
+static void add_decimals( bigNum *coeff, int scale )
+{
+    while ( scale-- > 0 )
+        big_mul_small( coeff, 10 );
+}
+
+/* Adds the term to the like term in poly, or as a new one. */
+static void poly_add_term( sparsePoly *poly, const int *exps, const bigNum *coeff, int scale )
+{
+    bool is_new;
+    int *id = pc_find( &poly->pc, exps, &is_new );
+
+    if ( is_new ) {
+        if ( poly->nr_terms == poly->cap ) {
+            poly->cap = ( poly->cap == 0 ) ? 16 : 2 * poly->cap;
+            poly->exps = tree_alloc( poly->exps, ( size_t ) poly->cap * poly->nr_vars * sizeof( int ) );
+            poly->coeffs = tree_alloc( poly->coeffs, poly->cap * sizeof( bigNum ) );
+            poly->scales = tree_alloc( poly->scales, poly->cap * sizeof( int ) );
+        }
+        *id = poly->nr_terms++;
+        memcpy( poly->exps + ( size_t ) *id * poly->nr_vars, exps, poly->nr_vars * sizeof( int ) );
+        big_init( &poly->coeffs[*id] );
+        big_copy( &poly->coeffs[*id], coeff );
+        poly->scales[*id] = scale;
+        return;
+    }
+    bigNum *sum = &poly->coeffs[*id];
+    if ( scale > poly->scales[*id] ) {
+        add_decimals( sum, scale - poly->scales[*id] );
+        poly->scales[*id] = scale;
+    }
+    if ( scale < poly->scales[*id] ) {
+        bigNum tmp;
+        big_init( &tmp );
+        big_copy( &tmp, coeff );
+        add_decimals( &tmp, poly->scales[*id] - scale );
+        big_add( sum, &tmp );
+        big_free( &tmp );
+    } else {
+        big_add( sum, coeff );
+    }
+}
+
+static sparsePoly *poly_new( int nr_vars )
+{
+    sparsePoly *poly = tree_alloc( NULL, sizeof( sparsePoly ) );
+    poly_init( poly, nr_vars );
+    return poly;
+}
+
+/* a * b */
+static sparsePoly *poly_mul( const sparsePoly *a, const sparsePoly *b )
+{
+    int nr_vars = a->nr_vars;
+    sparsePoly *res = poly_new( nr_vars );
+    int *exps = tree_alloc( NULL, ( nr_vars + 1 ) * sizeof( int ) );
+    bigNum prod;
+
+    big_init( &prod );
+    for ( int i = 0; i < a->nr_terms; i++ ) {
+        if ( big_is_zero( &a->coeffs[i] ) )
+            continue;
+        for ( int j = 0; j < b->nr_terms; j++ ) {
+            if ( big_is_zero( &b->coeffs[j] ) )
+                continue;
+            for ( int v = 0; v < nr_vars; v++ )
+                exps[v] = a->exps[i * nr_vars + v] + b->exps[j * nr_vars + v];
+            big_mul( &prod, &a->coeffs[i], &b->coeffs[j] );
+            poly_add_term( res, exps, &prod, a->scales[i] + b->scales[j] );
+        }
+    }
+    big_free( &prod );
+    free( exps );
+    return res;
+}
+
+/* base^n, by the multinomial theorem over the terms of base, that aren't
+ * 0. Returns NULL if there are too many terms for the terms table. */
+static sparsePoly *poly_pow( const sparsePoly *base, int n )
+{
+    int nr_vars = base->nr_vars,
+        k = 0;
+    int *terms = tree_alloc( NULL, ( base->nr_terms + 1 ) * sizeof( int ) ),
+        *exps = tree_alloc( NULL, ( nr_vars + 1 ) * sizeof( int ) );
+    sparsePoly *res = poly_new( nr_vars );
+    bigNum coeff, tmp;
+
+    big_init( &coeff );
+    big_init( &tmp );
+    for ( int t = 0; t < base->nr_terms; t++ ) {
+        if ( !big_is_zero( &base->coeffs[t] ) )
+            terms[k++] = t;
+    }
+    if ( n == 0 || k <= 1 ) {
+       /* 1, 0 or a power of one term. */
+        memset( exps, 0, nr_vars * sizeof( int ) );
+        big_set( &coeff, ( n == 0 || k == 1 ) ? 1L : 0L );
+        int scale = 0;
+        if ( n > 0 && k == 1 ) {
+            for ( int v = 0; v < nr_vars; v++ )
+                exps[v] = base->exps[terms[0] * nr_vars + v] * n;
+            for ( int e = 0; e < n; e++ ) {
+                big_mul( &tmp, &coeff, &base->coeffs[terms[0]] );
+                big_copy( &coeff, &tmp );
+            }
+            scale = base->scales[terms[0]] * n;
+        }
+        if ( k == 1 || n == 0 )
+            poly_add_term( res, exps, &coeff, scale );
+    } else {
+        int *table, *ones = tree_alloc( NULL, k * sizeof( int ) );
+        int rows = mk_permtable( k, n, NULL, 0, 1, NULL, &table );
+        if ( rows == -1 ) {
+            poly_free( res );
+            free( res );
+            free( ones );
+            big_free( &tmp );
+            big_free( &coeff );
+            free( exps );
+            free( terms );
+            return NULL;
+        }
+       /* The powers 0..n of the coeffecients of the terms. */
+        bigNum *pwr = tree_alloc( NULL, ( size_t ) k * ( n + 1 ) * sizeof( bigNum ) );
+        for ( int i = 0; i < k; i++ ) {
+            ones[i] = 1;
+            big_init( &pwr[i * ( n + 1 )] );
+            big_set( &pwr[i * ( n + 1 )], 1L );
+            for ( int e = 1; e <= n; e++ ) {
+                big_init( &pwr[i * ( n + 1 ) + e] );
+                big_mul( &pwr[i * ( n + 1 ) + e], &pwr[i * ( n + 1 ) + e - 1], &base->coeffs[terms[i]] );
+            }
+        }
+        for ( int r = 0; r < rows; r++ ) {
+            int *row = table + r * ( k + 1 ),
+                scale = 0;
+            if ( row[k] != MNOM_TOO_BIG )
+                big_set( &coeff, row[k] );
+            else
+                term_coeff( k, n, row, ones, &coeff );
+            memset( exps, 0, nr_vars * sizeof( int ) );
+            for ( int i = 0; i < k; i++ ) {
+                if ( row[i] == 0 )
+                    continue;
+                const int *term = base->exps + terms[i] * nr_vars;
+                for ( int v = 0; v < nr_vars; v++ )
+                    exps[v] += term[v] * row[i];
+                scale += base->scales[terms[i]] * row[i];
+                big_mul( &tmp, &coeff, &pwr[i * ( n + 1 ) + row[i]] );
+                big_copy( &coeff, &tmp );
+            }
+            poly_add_term( res, exps, &coeff, scale );
+        }
+        for ( int i = 0; i < k; i++ ) {
+            for ( int e = 0; e <= n; e++ )
+                big_free( &pwr[i * ( n + 1 ) + e] );
+        }
+        free( pwr );
+        free( ones );
+        free( table );
+    }
+    big_free( &tmp );
+    big_free( &coeff );
+    free( exps );
+    free( terms );
+    return res;
+}
+
+/* The polynomial of node id, from the ones of its kids, made once. Returns
+ * NULL if a power had too many terms. */
+static sparsePoly *node_poly( exprTree *tree, int id )
+{
+    treeNode *node = &tree->nodes[id];
+    int nr_vars = tree->nr_vars;
+
+    if ( node->poly != NULL )
+        return node->poly;
+
+    sparsePoly *poly = NULL;
+    int *exps = tree_alloc( NULL, ( nr_vars + 1 ) * sizeof( int ) );
+    bigNum coeff;
+    big_init( &coeff );
+    memset( exps, 0, nr_vars * sizeof( int ) );
+
+    switch ( node->kind ) {
+    case N_CONST:
+    case N_VAR:
+        poly = poly_new( nr_vars );
+        big_set( &coeff, ( node->kind == N_CONST ) ? node->val : 1L );
+        if ( node->kind == N_VAR )
+            exps[node->val] = 1;
+        poly_add_term( poly, exps, &coeff, ( node->kind == N_CONST ) ? node->scale : 0 );
+        break;
+    case N_SUM:
+        poly = poly_new( nr_vars );
+        for ( int i = 0; i < node->nr_kids; i++ ) {
+            sparsePoly *kid = node_poly( tree, node->kids[i] );
+            if ( kid == NULL ) {
+                poly_free( poly );
+                free( poly );
+                poly = NULL;
+                break;
+            }
+            for ( int t = 0; t < kid->nr_terms; t++ ) {
+                big_copy( &coeff, &kid->coeffs[t] );
+                if ( node->signs[i] == MINUS )
+                    coeff.neg = !coeff.neg;
+                poly_add_term( poly, kid->exps + t * nr_vars, &coeff, kid->scales[t] );
+            }
+        }
+        break;
+    case N_PRODUCT:
+        for ( int i = 0; i < node->nr_kids; i++ ) {
+            sparsePoly *kid = node_poly( tree, node->kids[i] ),
+                *prod;
+            if ( kid == NULL ) {
+                prod = NULL;
+            } else if ( i == 0 ) {
+                continue;
+            } else {
+                prod = poly_mul( ( i == 1 ) ? node_poly( tree, node->kids[0] ) : poly, kid );
+            }
+            if ( i > 1 ) {
+                poly_free( poly );
+                free( poly );
+            }
+            poly = prod;
+            if ( poly == NULL )
+                break;
+        }
+        break;
+    case N_POWER: {
+        sparsePoly *base = node_poly( tree, node->kids[0] );
+        poly = ( base == NULL ) ? NULL : poly_pow( base, node->val );
+        break;
+    }
+    }
+    big_free( &coeff );
+    free( exps );
+    node->poly = poly;
+    return poly;
+}
+
+static THREAD_LOCAL int sort_nr_vars;
+
+/* The TERM_ORDER of the flat expansion, the terms of a nested expression
+ * can have different degrees though, so grlex and grevlex compares the
+ * degrees first. */
+static int cmp_terms( const void *a, const void *b )
+{
+    const int *x = *( const int *const * ) a,
+        *y = *( const int *const * ) b;
+    int n = sort_nr_vars;
+
+    if ( TERM_ORDER == ORD_GRLEX || TERM_ORDER == ORD_GREVLEX ) {
+        int deg_x = 0, deg_y = 0;
+        for ( int v = 0; v < n; v++ ) {
+            deg_x += x[v];
+            deg_y += y[v];
+        }
+        if ( deg_x != deg_y )
+            return ( deg_x > deg_y ) ? -1 : 1;
+    }
+    for ( int i = 0; i < n; i++ ) {
+        int v = ( TERM_ORDER == ORD_LEX || TERM_ORDER == ORD_GRLEX ) ? i : n - 1 - i;
+        if ( x[v] != y[v] ) {
+           /* grevlex has the lowest power of the last variable first */
+            bool first = ( TERM_ORDER == ORD_GREVLEX ) ? x[v] < y[v] : x[v] > y[v];
+            return first ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static void tree_free( exprTree *tree )
+{
+    for ( int id = 0; id < tree->nr_nodes; id++ ) {
+        treeNode *node = &tree->nodes[id];
+        if ( node->poly != NULL ) {
+            poly_free( node->poly );
+            free( node->poly );
+        }
+        free( node->key );
+        free( node->signs );
+        free( node->kids );
+    }
+    free( tree->nodes );
+    free( tree->slots );
+}
+
+/* Does the expression need the tree, that is, has it parentheses within
+ * the parentheses? */
+bool expr_is_nested( const char *line )
+{
+    const char *first = strchr( line, PLEFT );
+    return first != NULL && strchr( first + 1, PLEFT ) != NULL;
+}
+
+/**
+ * @brief Parses and expands a nested expression, and writes the terms to
+ * fp, through a sink, like expand_expression().
+ * @detail line is the line of the expression in a batch, or 0. If echo is
+ * true, then the expression is printed on stdout first, with " =" after
+ * it, like the flat expressions. Returns 0, or -1 on a syntax error, or if
+ * the options can't be used with a nested expression.
+ */
+int tree_expand( const char *expr, FILE *fp, long line, bool echo )
+{
+    if ( EVAL_MODE || BOUNDS_ARG != NULL || TOP_K > 0 || GRAY_ORDER || TERM_ROW >= 0
+         || INDEX_ARG != NULL || NR_SHARDS > 1 || RANGE_MODE || ESTIMATE_MODE || APPROX_MODE
+         || STATS_MODE ) {
+        if ( line > 0 )
+            fprintf( stderr, "line %ld: ", line );
+        fprintf( stderr, "A nested expression can't be used together with -e, -c, -b, -g, --top,"
+                 " --term, --index, --shard, --range, --estimate, --approx or --stats.\n" );
+        return -1;
+    }
+    exprTree tree = { expr, 0, { 0 }, 0, NULL, 0, 0, NULL, 0, 0 };
+    if ( echo ) {
+        printf( "%s", expr );
+        fflush( stdout );
+    }
+    argstr = ( char * ) expr;
+    PARSE_LINENO = line;
+
+    int root = parse_sum( &tree );
+    if ( root != -1 ) {
+        skip_spaces( &tree );
+        if ( tree.line[tree.pos] != '\0' && tree.line[tree.pos] != '\n' )
+            root = tree_error( &tree, ( tree.line[tree.pos] == PRIGHT ) ? "A ')' too many" : "Unexpected character" );
+    }
+    if ( root == -1 ) {
+        tree_free( &tree );
+        return -1;
+    }
+    if ( echo ) {
+        printf( " =\n" );
+        fflush( stdout );
+    }
+
+    sparsePoly *poly = node_poly( &tree, root );
+    if ( poly == NULL ) {
+        tree_free( &tree );
+        return -1;
+    }
+    TRACE( tree_done, tree.nr_nodes, tree.nr_shared, poly->nr_terms );
+
+    const int **order = tree_alloc( NULL, ( poly->nr_terms + 1 ) * sizeof( int * ) );
+    int nr_terms = 0;
+    for ( int t = 0; t < poly->nr_terms; t++ ) {
+        if ( !big_is_zero( &poly->coeffs[t] ) )
+            order[nr_terms++] = poly->exps + t * tree.nr_vars;
+    }
+    sort_nr_vars = tree.nr_vars;
+    qsort( order, nr_terms, sizeof( int * ), cmp_terms );
+
+    termSink *out = sink_open( OUT_FORMAT, fp, tree.nr_vars, tree.vars, nr_terms * ( 16.0 + 3 * tree.nr_vars ), line );
+    for ( int i = 0; i < nr_terms; i++ ) {
+        int t = ( int ) ( ( order[i] - poly->exps ) / ( tree.nr_vars > 0 ? tree.nr_vars : 1 ) );
+        char *digits = big_to_digits( &poly->coeffs[t] );
+        sink_term( out, poly->coeffs[t].neg, digits, poly->scales[t], order[i] );
+        free( digits );
+    }
+    sink_close( out );
+    free( order );
+    tree_free( &tree );
+    return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <errno.h>
+#include "multinom.h"
+/*
+ * fastparse.c
+ * ===========
+ *
+ * A hand-written parser for the flat expressions, (c1x1 + c2x2 + ...)^n,
+ * that the batch mode uses instead of the scanner of multinom.l.
+ * It takes the same tokens as the rules of the scanner, the longest match
+ * first, and validates them with validator() as it goes, but the operands,
+ * the operators and the power goes straight into the tables that
+ * make_vartables() would have made: there are no items, no itemTable, and
+ * no allocation per token. There is no lex_lock to wait for either, so the
+ * workers of the batch mode parses their lines at the same time.
+ *
+ * The syntax errors are the same as the ones of the scanner, with the caret
+ * at the same position, consumed_text and ignored_spaces are counted the
+ * same way.
+ */
+
+/* Every variable, a-z and A-Z, can only be used once, and so can a
+ * constant, so this many operands, and operators, is as many as there can
+ * be before a syntax error. */
+#define FP_MAX_VARS 53
+
+/* The length of the decimal at s, like {decimal} in multinom.l, or 0. */
+static int decimal_len( const char *s )
+{
+    const char *p = s;
+    while ( isdigit( ( unsigned char ) *p ) )
+        p++;
+    if ( *p == '.' && isdigit( ( unsigned char ) p[1] ) ) {
+        p++;
+        while ( isdigit( ( unsigned char ) *p ) )
+            p++;
+    }
+    return p - s;
+}
+
+static bool is_letter( char c )
+{
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' );
+}
+
+/* Gives back the tables of an expression that had a syntax error. */
+static int parse_failed( exprData *expr )
+{
+    free_vartables( &expr->vars, &expr->coeffs, &expr->scales, &expr->ops );
+    expr->vars = expr->ops = NULL;
+    expr->coeffs = expr->scales = NULL;
+    return -1;
+}
+
+/**
+ * @brief Parses one line into expr, like parse_expr().
+ * @detail
+ * Returns 0, or -1 after a syntax error, that has been reported with the
+ * line number, lineno 0 leaves the number out. The tables of expr are freed
+ * with free_vartables().
+ */
+int fast_parse( const char *line, long lineno, exprData *expr )
+{
+    bool used[UCHAR_MAX + 1] = { false }; /* the variables so far, and '\0'
+                                             for a constant */
+    const char *p = line;
+    validity end_cond = OK;
+    int nr_items = 0;
+
+    consumed_text = 0;
+    ignored_spaces = 0;
+    validator_reset(  );
+    argstr = ( char * ) line;
+    PARSE_LINENO = lineno;
+    TRACE( parse_start, lineno );
+    expr->nrvars = 0;
+    expr->nrops = 0;
+    expr->exponent = 0;
+    expr->vars = malloc( FP_MAX_VARS );
+    expr->coeffs = malloc( FP_MAX_VARS * sizeof( int ) );
+    expr->scales = malloc( FP_MAX_VARS * sizeof( int ) );
+    expr->ops = malloc( FP_MAX_VARS );
+    if ( expr->vars == NULL || expr->coeffs == NULL || expr->scales == NULL || expr->ops == NULL ) {
+        if ( lineno > 0 )
+            fprintf( stderr, "line %ld: ", lineno );
+        fprintf( stderr, "fast_parse: Out of memory\n" );
+        return parse_failed( expr );
+    }
+
+    while ( *p != '\0' ) {
+        const char *s = ( *p == '-' || *p == '+' ) ? p + 1 : p;
+        int dlen = decimal_len( s ),
+            item_type,
+            len = 1,
+            coeff = 0,
+            scale = 0;
+        char var = 0;
+
+        if ( *p == ' ' ) {
+            ignored_spaces++;
+            p++;
+            continue;
+        } else if ( *p == '\t' ) {
+            ignored_spaces += TABSPACING;
+            p++;
+            continue;
+        } else if ( *p == '\n' ) {
+            p++;
+            continue;
+        } else if ( dlen > 0 ) {
+            char *endptr;
+            long val = str2decimal( ( char * ) p, &endptr, &scale );
+
+            if ( errno != 0 ) {
+                syntax_err2( "newVariable:str2decimal", strerror( errno ) );
+                return parse_failed( expr );
+            }
+            if ( !is_letter( s[dlen] ) ) {
+                syntax_err2( "newVariable", "Missing variable!" );
+                return parse_failed( expr );
+            }
+            if ( val >= INT_MAX ) {
+                syntax_err2( "newVariable", "Value greater than INT_MAX!" );
+                return parse_failed( expr );
+            }
+            coeff = ( int ) val;
+            var = s[dlen];
+            len = s - p + dlen + 1;
+            item_type = OPERAND;
+        } else if ( is_letter( *s ) ) {
+            coeff = ( *p == '-' ) ? -1 : 1;
+            var = *s;
+            len = s - p + 1;
+            item_type = OPERAND;
+        } else if ( s > p ) {
+            item_type = OPERATOR;
+        } else if ( *p == PLEFT ) {
+            item_type = LEFT_P;
+        } else if ( *p == PRIGHT ) {
+            item_type = RIGHT_P;
+        } else if ( *p == '^' && isdigit( ( unsigned char ) p[1] ) ) {
+            char *endptr;
+            errno = 0;
+            long val = strtol( p + 1, &endptr, 10 );
+
+            if ( errno != 0 ) {
+                syntax_err2( "newPower:strtol", strerror( errno ) );
+                return parse_failed( expr );
+            }
+            if ( val >= INT_MAX ) {
+                syntax_err2( "newPower", "Value greater than INT_MAX!" );
+                return parse_failed( expr );
+            }
+            expr->exponent = ( int ) val;
+            len = endptr - p;
+            item_type = PWR_V;
+        } else {
+            syntax_err( "LEX: Illegal character." );
+            return parse_failed( expr );
+        }
+        if ( item_type == OPERAND ) {
+            if ( used[( unsigned char ) var] ) {
+                syntax_err2( "newVariable", "A variable can only be used once in an expression!" );
+                return parse_failed( expr );
+            }
+            used[( unsigned char ) var] = true;
+        }
+
+        if ( end_cond == ACCEPT ) {
+            syntax_err( "Nothing can follow the power." );
+            return parse_failed( expr );
+        }
+        end_cond = validator( item_type, &expr->nrvars, &expr->nrops, &nr_items );
+        if ( end_cond == FAIL ) {
+            syntax_err( NULL );
+            return parse_failed( expr );
+        }
+        if ( item_type == OPERAND ) {
+            expr->vars[expr->nrvars - 1] = var;
+            expr->coeffs[expr->nrvars - 1] = coeff;
+            expr->scales[expr->nrvars - 1] = scale;
+        } else if ( item_type == OPERATOR ) {
+            expr->ops[expr->nrops - 1] = *p;
+        }
+        consumed_text += len;
+        p += len;
+    }
+    if ( end_cond != ACCEPT ) {
+        syntax_err( "Missing the power." );
+        return parse_failed( expr );
+    }
+    TRACE( parse_done, lineno, expr->nrvars, expr->exponent );
+    return 0;
+}
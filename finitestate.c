@@ -42,10 +42,18 @@
 
 typedef enum { S_START, S_OPERAND, S_OP_OR_RP, S_PWR } fsm_state;
 
+/* Per thread, so that the workers of the batch mode can validate an
+ * expression each. */
+static THREAD_LOCAL fsm_state next_state = S_START;
+
+/* Starts over, for the next expression. */
+void validator_reset( void )
+{
+    next_state = S_START;
+}
+
 validity validator( int item_type, int *nrvars, int *nrops, int *nritems )
 {
-   // update after?
-    static fsm_state next_state = S_START;
     validity ret = FAIL;
     switch ( next_state ) {
     case S_START:{
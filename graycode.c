@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include "multinom.h"
+/*
+ * graycode.c
+ * ==========
+ *
+ * Expands the multinomial with the terms in a minimal change order: the
+ * powers of two neighbouring terms differ in that one of the variables has
+ * given one to another. The coeffecient of a term then follows from the
+ * coeffecient of the one before it: when a gives one to b
+ *
+ *      T' = T * e_a * c_b / ( ( e_b + 1 ) * c_a )
+ *
+ * and the division is exact, since T' is an integer too. So there is no
+ * multinomial coeffecients or powers to compute for every term, and no
+ * terms table.
+ *
+ * The order: A(m) is the list of compositions of m into the positions
+ * pos..k-1, that starts with (m,0,...,0) and ends with (0,...,0,m). It is
+ * made by blocks, where x[pos] goes from m down to 0, and the rest of the
+ * positions runs through A(m - x[pos]), forwards when x[pos] is even and
+ * backwards when it is odd. A forward block ends with (0,...,0,t), and the
+ * backward block after it starts with (0,...,0,t+1), a backward block ends
+ * with (t,0,...,0) and the forward block after it starts with (t+1,0,...,0),
+ * so it is one move between every block, and the last block is always a
+ * forward one. The first term is still x^n, and the last is z^n.
+ */
+
+typedef struct {
+    int nr_vars, exponent;
+    int *coefftbl, *scaletbl;
+    int *exps;
+    long coeff;                 /* of the term in exps */
+    int scale;
+    termSink *out;
+} grayState;
+
+/* Moves one of the power from variable a to variable b, and updates the
+ * coeffecient. */
+static void gray_move( grayState *st, int a, int b )
+{
+    long c_a = st->coefftbl[a],
+        c_b = st->coefftbl[b],
+        mul = st->exps[a] * c_b,
+        div = ( st->exps[b] + 1 ) * c_a;
+
+    st->exps[a]--;
+    st->exps[b]++;
+    st->scale += st->scaletbl[b] - st->scaletbl[a];
+    if ( c_a == 0 || ( mul != 0 && labs( st->coeff ) > LONG_MAX / labs( mul ) ) ) {
+       /* The coeffecient was 0, or we can't multiply before we divide, so we
+          start over from scratch for this term. */
+        st->coeff = l_term_coeff( st->nr_vars, st->exponent, st->exps, st->coefftbl );
+    } else {
+        st->coeff = st->coeff * mul / div;
+    }
+}
+
+static void gray_visit( grayState *st )
+{
+    sink_term_long( st->out, st->coeff, st->scale, st->exps );
+}
+
+/* Runs through A(m) from pos, forwards or backwards, exps must hold the
+ * first composition in that direction when we are called, and holds the
+ * last one when we return. */
+static void gray_walk( grayState *st, int pos, int m, bool forwards )
+{
+    int last = st->nr_vars - 1;
+
+    if ( pos == last ) {
+        gray_visit( st );
+        return;
+    }
+    if ( forwards ) {
+        for ( int t = 0; t <= m; t++ ) {
+            bool sub_forwards = ( st->exps[pos] % 2 == 0 );
+            gray_walk( st, pos + 1, t, sub_forwards );
+            if ( t < m )
+                gray_move( st, pos, sub_forwards ? last : pos + 1 );
+        }
+    } else {
+        for ( int t = m; t >= 0; t-- ) {
+            bool sub_forwards = ( st->exps[pos] % 2 == 0 );
+            gray_walk( st, pos + 1, t, !sub_forwards );
+            if ( t > 0 )
+                gray_move( st, sub_forwards ? pos + 1 : last, pos );
+        }
+    }
+}
+
+/* The memory gray_expand() needs, the recursion is as deep as there are
+ * variables. */
+double gray_memory( int nr_vars )
+{
+    return ( double ) nr_vars * sizeof( int ) + sizeof( grayState );
+}
+
+/**
+ * @brief Writes the expansion to out, with the terms in the minimal change
+ * order.
+ * @detail The coefftbl must have been adjusted for the operators with
+ * adjust_coeffs() first.
+ */
+void gray_expand( int nr_vars, int exponent, int *coefftbl, int *scaletbl, termSink *out )
+{
+    grayState st;
+
+    st.nr_vars = nr_vars;
+    st.exponent = exponent;
+    st.coefftbl = coefftbl;
+    st.scaletbl = scaletbl;
+    st.out = out;
+    st.exps = calloc( nr_vars, sizeof( int ) );
+    if ( st.exps == NULL ) {
+        expand_fail( "gray_expand: Out of memory\n" );
+    }
+    st.exps[0] = exponent;
+    st.coeff = l_power( coefftbl[0], exponent );
+    st.scale = scaletbl[0] * exponent;
+
+    gray_walk( &st, 0, exponent, true );
+    free( st.exps );
+}
@@ -36,16 +36,17 @@
  * and make yylval point to it.
  * */
 
-static int sym[53]; /* 1 more for the case we have a coeffecient without a
+static THREAD_LOCAL int sym[53]; /* 1 more for the case we have a coeffecient without a
                        variable. */
 // check this out, I have it defined somewhere else!
 
-static itemData *mkVarNode( int coeff, char var )
+static itemData *mkVarNode( int coeff, int scale, char var )
 {
     itemData *retval = malloc( sizeof( itemData ) );
     if ( retval != NULL ) {
         retval->type = typeFact;
         retval->factor.coeff = coeff;
+        retval->factor.scale = scale;
         retval->factor.var = var;
         retval->next = NULL;
     } else {
@@ -83,6 +84,53 @@ static itemData *mkPowerNode( int pwer )
     return retval;
 }
 
+/* Reads a coeffecient with an optional sign and decimal point, like "-0.25",
+ * the way strtol() would, but the decimal point is dropped: we return -25 and
+ * store the number of decimals, 2, in scale. Trailing zeroes among the
+ * decimals are dropped too, so "1.50" becomes 15 with a scale of 1.
+ * errno is set to ERANGE if the digits doesn't fit in an int.
+ */
+long str2decimal( char *str, char **endptr, int *scale )
+{
+    char *p = str;
+    long val = 0;
+    bool negative = false,
+        decimals = false,
+        got_digits = false;
+
+    errno = 0;
+    *scale = 0;
+    if ( *p == '-' || *p == '+' ) {
+        negative = ( *p == '-' );
+        p++;
+    }
+    for ( ; isdigit( ( unsigned char ) *p ) || ( *p == '.' && !decimals ); p++ ) {
+        if ( *p == '.' ) {
+            decimals = true;
+            continue;
+        }
+        got_digits = true;
+        if ( val > ( INT_MAX - ( *p - '0' ) ) / 10 ) {
+            errno = ERANGE;
+            *endptr = p;
+            return negative ? INT_MIN : INT_MAX;
+        }
+        val = val * 10 + ( *p - '0' );
+        if ( decimals )
+            ( *scale )++;
+    }
+    if ( !got_digits ) {
+        *endptr = str;
+        return 0L;
+    }
+    *endptr = p;
+    while ( *scale > 0 && val % 10 == 0 ) {
+        val /= 10;
+        ( *scale )--;
+    }
+    return negative ? -val : val;
+}
+
 /* This only checks if it has been used, the converted char value is not the value we store
  * in the variable array Here we store the original char value, or '0' for no variable
  * name (coeffecient).
@@ -99,7 +147,7 @@ static bool accepted_var( char var )
     } else {
         syntax_err( NULL );
         fprintf( stderr, "accepted_var: Can't happen varable name outside legal range: %c\n", var );
-        exit( EXIT_FAILURE );
+        parse_fail(  );
     }
     if ( sym[( int ) var] > 0 ) {
         return false;
@@ -109,6 +157,12 @@ static bool accepted_var( char var )
     }
 }
 
+/* Forgets the variables of the last expression, before the next one. */
+void reset_vars( void )
+{
+    memset( sym, 0, sizeof( sym ) );
+}
+
 itemData *newOperator( char *str )
 {
     return mkOperNode( *str );
@@ -118,22 +172,23 @@ itemData *newPower( char *str )
 {
     char *endptr;
     str++;
+    errno = 0;
     long val = strtol( str, &endptr, 10 );
 
     if ( errno != 0 ) {
         syntax_err2( "newPower:strtol", strerror( errno ) );
-        exit( EXIT_FAILURE );
+        parse_fail(  );
     }
 
     if ( endptr == str ) {
         syntax_err2( "newPower:", "No digits were found" );
         fprintf( stderr, "No digits were found\n" );
-        exit( EXIT_FAILURE );
+        parse_fail(  );
     }
 
     if ( val >= INT_MAX ) {
         syntax_err2( "newPower", "Value greater than INT_MAX!" );
-        exit( EXIT_FAILURE );
+        parse_fail(  );
     }
     int pwer = ( int ) val;
     return mkPowerNode( pwer );
@@ -142,34 +197,35 @@ itemData *newPower( char *str )
 itemData *newVariable( char *str, int len, content_type what )
 {
     itemData *retval = NULL;
-    int coeff = 0;
+    int coeff = 0,
+        scale = 0;
     char var = 0;
     switch ( what ) {
     case F_FULL:{
           /* also covers no sign */
             char *endptr;
-            long val = strtol( str, &endptr, 10 );
+            long val = str2decimal( str, &endptr, &scale );
 
             if ( errno != 0 ) {
-                syntax_err2( "newVariable:strtol", strerror( errno ) );
-                exit( EXIT_FAILURE );
+                syntax_err2( "newVariable:str2decimal", strerror( errno ) );
+                parse_fail(  );
             }
 
             if ( endptr == str ) {
                 syntax_err2( "newVariable:", "No digits were found" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
 
             if ( *endptr == '\0' ) { /* Not necessarily an error... */
                 syntax_err2( "newVariable", "Missing variable!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
             if ( val >= INT_MAX ) {
                 syntax_err2( "newVariable", "Value greater than INT_MAX!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             } else if ( val <= INT_MIN ) {
                 syntax_err2( "newVariable", "Value less than INT_MIN!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
 
 
@@ -178,14 +234,14 @@ itemData *newVariable( char *str, int len, content_type what )
             var = *endptr;
             if ( *( endptr + 1 ) != '\0' ) {
                 syntax_err2( "newVariable", "Variable can only be one character!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
 
             }
             if ( !accepted_var( var ) ) {
                 syntax_err2( "newVariable", "A variable can only be used once in an expression!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             } else {
-                retval = mkVarNode( coeff, var );
+                retval = mkVarNode( coeff, scale, var );
             }
             break;
         }
@@ -193,7 +249,7 @@ itemData *newVariable( char *str, int len, content_type what )
           /* but with a sign */
             if ( len > 2 ) {
                 syntax_err2( "newVariable", "Variable can only be one character!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
 
             if ( *str == '-' ) {
@@ -209,60 +265,60 @@ itemData *newVariable( char *str, int len, content_type what )
             var = *str;
             if ( !accepted_var( var ) ) {
                 syntax_err2( "newVariable", "A variable can only be used once in an expression!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             } else {
-                retval = mkVarNode( coeff, var );
+                retval = mkVarNode( coeff, scale, var );
             }
             break;
         }
     case F_JUSTVAR:{
             if ( len > 1 ) {
                 syntax_err2( "newVariable", "Variable can only be one character!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
             coeff = 1;
             var = *str;
             if ( !accepted_var( var ) ) {
                 syntax_err2( "newVariable", "A variable can only be used once in an expression!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             } else {
-                retval = mkVarNode( coeff, var );
+                retval = mkVarNode( coeff, scale, var );
             }
             break;
         }
     case F_JUST_COEFF:{
             char *endptr;
-            long val = strtol( str, &endptr, 10 );
+            long val = str2decimal( str, &endptr, &scale );
 
             if ( errno != 0 ) {
-                syntax_err2( "newVariable:strtol", strerror( errno ) );
-                exit( EXIT_FAILURE );
+                syntax_err2( "newVariable:str2decimal", strerror( errno ) );
+                parse_fail(  );
             }
 
             if ( endptr == str ) {
                 syntax_err2( "newVariable:", "No digits were found" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
 
             if ( *endptr == '\0' ) { /* Not necessarily an error... */
                 syntax_err2( "newVariable", "Missing variable!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
             if ( val >= INT_MAX ) {
                 syntax_err2( "newVariable", "Value greater than INT_MAX!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             } else if ( val <= INT_MIN ) {
                 syntax_err2( "newVariable", "Value less than INT_MIN!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             }
 
             coeff = ( int ) val;
             var = 0;
             if ( !accepted_var( var ) ) {
                 syntax_err2( "newVariable", "A variable can only be used once in an expression!" );
-                exit( EXIT_FAILURE );
+                parse_fail(  );
             } else {
-                retval = mkVarNode( coeff, var );
+                retval = mkVarNode( coeff, scale, var );
             }
             break;
         }
@@ -25,10 +25,45 @@
 #ifndef MULTINOM_H
 #define MULTINOM_H
 #include <stdbool.h>
+#include <stdio.h> /* FILE */
+#include <stdint.h>
+#include <setjmp.h>
+
+/* Static tracepoints for perf and bpftrace, provider multinom, built in
+ * with "make USDT=1", that needs sys/sdt.h of systemtap. Without it they
+ * are nothing, and their arguments aren't evaluated. See tracing/ for
+ * example scripts. The probes, and their arguments:
+ *  parse_start          line (0 outside a batch)
+ *  parse_done           line, nr_vars, exponent
+ *  permtable_start      nr_vars, exponent
+ *  permtable_progress   row, nr_rows, every TRACE_ROWS rows of a serial table,
+ *                       or of the rows of a permtable_chunk, in the thread
+ *                       of a worker of a parallel table
+ *  permtable_chunk      lo, hi, the rows a worker of a parallel table takes
+ *  permtable_done       nr_vars, exponent, nr_rows
+ *  coeff_start          nr_vars, exponent, nr_rows
+ *  coeff_done           nr_vars, exponent, nr_rows, partitions cached
+ *  memory_chunk         chunk, nr_chunks, nr_rows, a chunk of --max-memory is done
+ *  expand_start         nr_vars, exponent, nr_rows, nr_threads
+ *  expand_chunk         lo, hi, the rows a worker of the expansion takes
+ *  expand_done          nr_vars, exponent, nr_rows, bytes of the sink so far
+ *  tree_done            nodes, nodes shared, terms, of a nested expression
+ *  output_done          nr_terms, bytes, when a sink is closed */
+#ifdef USDT
+#include <sys/sdt.h>
+#define TRACE( name, ... ) STAP_PROBEV( multinom, name, __VA_ARGS__ )
+#else
+#define TRACE( name, ... ) ( ( void ) 0 )
+#endif
+#define TRACE_ROWS 65536        /* rows between the progress probes */
+
 /* We aren't using yacc so we need to define our own values  for returned datatypes. */
 
-/* For the record: we change the decimal separator with a sed script, since it is a no can
- * do from within lex. */
+/* Decimal coefficients like "0.25x" are read as a scaled integer: the digits
+ * without the decimal point, and the number of decimals as the scale, so 0.25
+ * becomes 25 with a scale of 2. The expansion is then done in integer
+ * arithmetic, and the scale of each term is applied when it is printed.
+ * The decimal separator is always a '.' */
 
 #define MINUS '-'
 #define PLUS '+'
@@ -52,7 +87,8 @@ typedef enum { F_FULL, F_NO_COEFF, F_JUSTVAR, F_JUST_COEFF } content_type;
 typedef enum { typeFact, typeOpr, typePwr } nodeEnum;
 /* constants */
 typedef struct {
-    int coeff;      /* value of constant */
+    int coeff;      /* value of constant, without any decimal point */
+    int scale;      /* number of decimals in the constant */
     char var ;
 } factNodeType;
 
@@ -81,7 +117,11 @@ struct nodeTypeTag {
 
 typedef enum { FAIL=0,OK,ACCEPT} validity ;
 
-extern itemData *yylval ;
+/* The state of the parse is per thread, so that the workers of the batch
+ * mode can parse an expression each. */
+#define THREAD_LOCAL __thread
+
+extern THREAD_LOCAL itemData *yylval ;
 
 /* Variables for pointing to syntax errors in the expressions.
  * TODO: tabs are so far surmised to be 8 spaces, this must change to a
@@ -93,51 +133,348 @@ extern itemData *yylval ;
  *  We add to ignored_spaces within yylex(), and add yyleng to consumed_text
  *  after the expression has been  validitated after lexing in main().
  */
-extern int consumed_text;
-extern int ignored_spaces;
+extern THREAD_LOCAL int consumed_text;
+extern THREAD_LOCAL int ignored_spaces;
 
 /*
  * GLOBAL variables during parsing
  * Freeing memory, if exiting due to syntax errors in yylex();
  */
-extern bool PARSING_STAGE; 
-extern int nritems;
-extern itemData **itemTable;
-extern itemData itemsHead;
+extern THREAD_LOCAL bool PARSING_STAGE; 
+extern THREAD_LOCAL int nritems;
+extern THREAD_LOCAL itemData **itemTable;
+extern THREAD_LOCAL itemData itemsHead;
 extern bool NO_PREPROC;
-extern char *argstr; /* freed by an atexit routine */
+extern THREAD_LOCAL char *argstr; /* freed by an atexit routine */
+
+/* An expression, once it has been parsed, with the tables from
+ * make_vartables(). */
+typedef struct {
+    int nrvars, nrops, exponent;
+    char *vars, *ops;
+    int *coeffs, *scales;
+} exprData;
+
+/* Parses one line into expr, returns 0, or -1 after a syntax error, that
+ * has been reported with the line number. lineno 0 leaves the number out. */
+int parse_expr(const char *line, long lineno, exprData *expr);
 /* MODULE permute.o */
+
+/* The last column of a row in the terms table holds the multinomial
+ * coeffecient, or this, when they don't all fit in an int. */
+#define MNOM_TOO_BIG -1
+
+/* The orders of the terms, of --order. */
+typedef enum { ORD_LEX = 0, ORD_GRLEX, ORD_REVLEX, ORD_GREVLEX } term_order;
+
+/* The widths of integers we compute the coeffecients of the terms in, or
+ * W_LOG, for --approx, doubles with the log10 of them. */
+typedef enum { W_LONG, W_INT128, W_BIG, W_LOG } arith_width;
+
 int power(int base, int exp);
-int mk_permtable(int nr_vars, int exponent, int **terms_table );
+long l_power(long base, int exp);
+long l_multinom(int nr_vars, int exponent, int *exps);
+long l_term_coeff(int nr_vars, int exponent, int *exps, int *coefftbl);
+double coeff_bound_bits(int nr_vars, int exponent, int *coefftbl);
+int mk_permtable(int nr_vars, int exponent, int *bounds, int shard, int nr_shards, long *first,
+        int **terms_table );
+arith_width coeff_width(int nr_vars, int exponent, int *coefftbl);
+int perm_order(const char *name);
 void print_term_tbl(int nr_vars,int exponent, int *terms_table,  int nr_rows );
 
 /* MODULE mk_struct.o */
 itemData *newOperator( char *str );
 itemData *newPower( char *str );
 itemData *newVariable( char *str, int len, content_type what);
+long str2decimal(char *str, char **endptr, int *scale);
+void reset_vars(void);
 void lexer_exit(void);
 
 /* MODULE syntax_err.o */
 void syntax_err(const char * const details) ;
 void syntax_err2(const char * const details1,const char * const details2);
+void parse_fail(void);
+/* Where parse_fail() goes, when it doesn't exit. */
+extern THREAD_LOCAL jmp_buf *PARSE_ERR_JMP;
+extern THREAD_LOCAL long PARSE_LINENO; /* of a batch, for the errors */
+void expand_fail(const char *format, ...);
+/* Where expand_fail() goes, the line of a batch that is being expanded. */
+extern THREAD_LOCAL jmp_buf *LINE_ERR_JMP;
 
 /* MODULE finitestate.o */
 validity validator( int item_type, int *nrvars, int *nrops, int *nritems);
+void validator_reset(void);
 
 /* MODULE vartables.o */
 int make_vartables(int nritems,itemData **itemTable, int nrvars, int nrops,
-        char **vars, int **coeffs, char **ops);
-void free_vartables(char **vars, int **coeffs, char **ops);
+        char **vars, int **coeffs, int **scales, char **ops);
+void free_vartables(char **vars, int **coeffs, int **scales, char **ops);
+int *make_bounds(const char *spec, int nrvars, char *vars);
+int *make_powers(const char *spec, int nrvars, char *vars);
+
+/* MODULE bignum.o */
+typedef struct {
+    uint32_t *limb;     /* the magnitude, least significant limb first */
+    int len, cap;
+    bool neg;
+} bigNum;
+
+void big_init(bigNum *b);
+void big_free(bigNum *b);
+void big_reserve(bigNum *b, int bits);
+void big_set(bigNum *b, long val);
+#ifdef __SIZEOF_INT128__
+void big_set_int128(bigNum *b, __int128 val);
+#endif
+void big_copy(bigNum *dst, const bigNum *src);
+void big_mul_small(bigNum *b, long m);
+void big_mul(bigNum *res, const bigNum *a, const bigNum *b);
+void big_add(bigNum *res, const bigNum *b);
+int big_cmp_mag(const bigNum *a, const bigNum *b);
+uint32_t big_div_small(bigNum *b, uint32_t d);
+bool big_is_zero(const bigNum *b);
+char *big_to_digits(const bigNum *b);
+
+/* MODULE sink.o */
+typedef enum { FMT_TEXT = 0, FMT_JSONL, FMT_CSV, FMT_LATEX } out_format;
+
+typedef struct termSink termSink;
+typedef struct termStats termStats;
+typedef struct sinkWriter sinkWriter;
+
+/* What a format does, at the beginning, for every term, and at the end. */
+typedef struct {
+    const char *name;
+    void (*begin)(termSink *out);
+    void (*term)(termSink *out, bool neg, const char *digits, int scale, const int *exps);
+    void (*end)(termSink *out);
+} sinkOps;
+
+struct termSink {
+    const sinkOps *ops;
+    FILE *fp;
+    int nr_vars;
+    char *vartable;
+    long nr_terms;          /* written so far */
+    long line;              /* of the expression in a batch, or 0 */
+    int power;              /* of the terms with --range, or 0 */
+    bool spool;             /* the parts to temporary files, not memory */
+    long bytes;             /* written to the sink, for the tracepoints */
+    bool ends;              /* writes the end of the output, not a shard before the last */
+    termStats *stats;       /* --stats: adds the terms up, instead of writing them */
+    sinkWriter *writer;     /* the thread that writes the full buffers, or NULL */
+    char *buf;              /* the buffered writer */
+    size_t len, cap;
+};
+
+int sink_format(const char *name);
+termSink *sink_open(out_format fmt, FILE *fp, int nr_vars, char *vartable, double size_hint,
+        long line);
+termSink *sink_shard(out_format fmt, FILE *fp, int nr_vars, char *vartable, double size_hint,
+        int shard, int nr_shards, long first);
+termSink *sink_power(out_format fmt, FILE *fp, int nr_vars, char *vartable, double size_hint,
+        int power);
+void sink_term(termSink *out, bool neg, const char *digits, int scale, const int *exps);
+void sink_term_long(termSink *out, long coeff, int scale, const int *exps);
+void sink_term_big(termSink *out, const bigNum *coeff, int scale, const int *exps);
+termSink *sink_stats(FILE *fp, int nr_vars, termStats *stats);
+void sink_close(termSink *out);
+termSink *sink_part(termSink *out, long first);
+void sink_join(termSink *out, termSink *part);
+
+/* MODULE coeffsimd.o */
+
+/* Terms in a block of coeff_block_long(). */
+#define COEFF_BLOCK 64
+
+void coeff_block_long(int nr_vars, int exponent, int nr_terms, const long *pwrtbl,
+        const int *exps, long *coeffs);
+const char *coeff_kernel_name(void);
 
 /* MODULE expand_expr.o */
-void expand_expr(int terms_rows, int nr_vars, int *terms_table,
-        char *vartable, int *coefftbl);
+void expand_expr(int terms_rows, int nr_vars, int exponent, int *terms_table,
+        int *coefftbl, int *scaletbl, termSink *out);
 void adjust_coeffs(int nr_vars,int *coefftbl, char *optbl);
+bool expand_small(int nr_vars, int exponent, int *coefftbl, int *scaletbl, termSink *out);
+
+/* MODULE evaluate.o */
+int eval_points(FILE *fp, int terms_rows, int nr_vars, int exponent, int *terms_table,
+        int *coefftbl, int *scaletbl, bool check);
+double eval_memory(int nr_vars, int exponent);
+
+/* MODULE topterms.o */
+void top_terms(int top_k, int nr_vars, int exponent, int *bounds,
+        int *coefftbl, int *scaletbl, termSink *out);
+double top_terms_memory(int top_k, int nr_vars, double nr_terms);
+
+/* MODULE graycode.o */
+void gray_expand(int nr_vars, int exponent, int *coefftbl, int *scaletbl, termSink *out);
+double gray_memory(int nr_vars);
+
+/* MODULE range.o */
+int range_expand(out_format fmt, FILE *fp, int nr_vars, char *vartable, int exponent,
+        int *coefftbl, int *scaletbl);
+
+/* MODULE estimate.o */
+typedef struct {
+    double terms;           /* in the expansion */
+    double out_bytes;       /* about how much the printout takes */
+    double coeff_bits;      /* that is enough for any coeffecient */
+    arith_width width;      /* expand_expr() computes the coeffecients in */
+    double mem_table;       /* peak memory of expand_expr(), */
+    double mem_fixed;       /* of that without the terms table, */
+    double mem_eval;        /* eval_points(), */
+    double mem_top, mem_top_per_k;  /* top_terms(), and for every term in the heap, */
+    double mem_top_max;     /* with every term in the heap, */
+    double mem_gray;        /* and gray_expand(). */
+} expEstimate;
+
+void estimate_expansion(int nr_vars, int exponent, int *bounds, int *coefftbl, int *scaletbl,
+        expEstimate *est);
+
+/* How the terms table is expanded within --max-memory. */
+typedef struct {
+    int nr_chunks;          /* the table is made in, one at the time */
+    bool spool;             /* the parts of the workers to temporary files */
+} memPlan;
+
+void plan_memory(const expEstimate *est, double budget, int nr_threads, memPlan *plan);
+void print_plan(const memPlan *plan, double budget);
+void print_estimate(const expEstimate *est);
+
+/* MODULE worksteal.o */
+
+/* What the workers of ws_run() does: init makes the state of a worker, leaf
+ * does the items lo..hi-1, and may leave a part, that emit gets in the
+ * order of the items, fini frees the state. Any of them but leaf may be
+ * NULL. */
+typedef struct {
+    void *(*init)(void *ctx);
+    void (*leaf)(void *ctx, void *local, long lo, long hi, void **part);
+    void (*emit)(void *ctx, void *part);
+    void (*fini)(void *ctx, void *local);
+} wsOps;
+
+int ws_threads(double nr_items);
+long ws_grain(long nr_items, int nr_threads);
+void ws_run(long nr_items, long grain, int nr_threads, const wsOps *ops, void *ctx);
+
+/* MODULE batch.o */
+int expand_expression(exprData *expr, FILE *fp, long line);
+int batch_run(FILE *in, FILE *out, int nr_threads);
+
+/* MODULE stats.o */
+struct termStats {
+    long terms, negative, nonzero;
+    int max_scale;          /* decimals of the coeffecients, at the most */
+    bigNum *sums;           /* sums[s] of the coeffecients with s decimals */
+    bigNum max, min;        /* the biggest and smallest nonzero |coeffecient| */
+    int max_sc, min_sc;     /* and their decimals */
+    long *bits;             /* bits[b]: the coeffecients of b bits */
+    int nr_bits;
+    bigNum val, tmp;
+};
+
+termStats *stats_new(int max_scale);
+void stats_free(termStats *st);
+void stats_big(termStats *st, const bigNum *coeff, int scale);
+void stats_long(termStats *st, long coeff, int scale);
+void stats_digits(termStats *st, bool neg, const char *digits, int scale);
+void stats_merge(termStats *st, const termStats *part);
+int stats_print(termStats *st, FILE *fp, int nr_vars, int exponent, int *coefftbl, int *scaletbl,
+        bool check, long line);
+
+/* MODULE primefact.o */
+
+/* From this exponent, expand_expr() makes the bignums from primes. */
+#define PF_MIN_EXPONENT 100
+
+typedef struct {
+    int nr_vars;
+    int *coefftbl;
+    int *exps;              /* the powers of the current term */
+    int *spf;               /* the smallest prime factor of 2..n */
+    int *prime_idx;         /* where the primes up to n are in primes */
+    uint32_t *primes;       /* the primes up to n, and of the coeffecients */
+    int nr_small, nr_primes;
+    int *coeff_fact;        /* pairs of a prime index and a power, per variable */
+    long *vec;              /* the power of every prime in the current term */
+    uint32_t *words;        /* the primes, packed for the product tree */
+    int cap_words;
+    bigNum *leaves, scratch;
+    int nr_leaves, cap_leaves;
+} primeTerm;
+
+void pf_init(primeTerm *pt, int nr_vars, int exponent, int *coefftbl);
+void pf_free(primeTerm *pt);
+void pf_move_to(primeTerm *pt, const int *exps);
+void pf_value(primeTerm *pt, bigNum *res);
+
+/* MODULE termindex.o */
+typedef struct {
+    int k, n;
+    int *bounds;            /* of every part, at most n */
+    long *ways;             /* the ways the positions i.. can add up to r */
+    long *below;            /* the sums of ways, up to r */
+} termIndex;
+
+bool ti_init(termIndex *ti, int k, int n, const int *bounds);
+void ti_free(termIndex *ti);
+long ti_count(const termIndex *ti);
+long ti_rank(const termIndex *ti, const int *exps);
+void ti_unrank(const termIndex *ti, long row, int *exps);
+void term_coeff(int nr_vars, int exponent, const int *exps, int *coefftbl, bigNum *res);
+
+/* MODULE partcache.o */
+typedef struct {
+    int keylen, nr_classes;
+    int *order;             /* the variables, class by class */
+    int *class_end;         /* where every class ends in order */
+    int *key;               /* scratch for the key we look up */
+    int *keys;              /* nr_keys keys of keylen powers */
+    void *vals;             /* nr_keys values of valsize bytes */
+    size_t valsize;
+    int nr_keys, cap_keys;
+    int *slots;             /* the hash table, with ids into keys */
+    int nr_slots;
+} partCache;
+
+void pc_init(partCache *pc, int nr_vars, int *coefftbl, size_t valsize);
+void pc_free(partCache *pc);
+void *pc_find(partCache *pc, const int *exps, bool *is_new);
+void *pc_value(partCache *pc, int id);
+
+/* MODULE exprtree.o */
+bool expr_is_nested(const char *line);
+int tree_expand(const char *expr, FILE *fp, long line, bool echo);
+
+/* MODULE fastparse.o */
+int fast_parse(const char *line, long lineno, exprData *expr);
 
 /* MODULE arguments.o */
 
 typedef enum { OPT_BAD= -1,OPT_NONE=0,OPT_HELP, OPT_PREPROCESS} opt_tp;
 
+extern bool EVAL_MODE;  /* -e: evaluate the expansion at points from stdin */
+extern bool EVAL_CHECK; /* -c: and check the values against (...)^n */
+extern char *BOUNDS_ARG; /* -b: maximum powers of the variables, like "x=2,y=3" */
+extern int TOP_K;       /* --top: print only this many of the biggest terms */
+extern bool GRAY_ORDER; /* -g: print the terms in the minimal change order */
+extern bool ESTIMATE_MODE; /* --estimate: just tell how big the expansion is */
+extern out_format OUT_FORMAT; /* -f: how the terms are written */
+extern term_order TERM_ORDER; /* --order: the order of the terms */
+extern long TERM_ROW;    /* --term: print just the term in this row, or -1 */
+extern char *INDEX_ARG; /* --index: print the row of the term, like "x=2,y=3" */
+extern int SHARD;       /* --shard i/N: print slice i-1 of N of the terms */
+extern int NR_SHARDS;
+extern bool RANGE_MODE; /* --range: print the powers 1..n */
+extern double MAX_MEMORY; /* --max-memory: bytes the expansion may use, or 0 */
+extern bool APPROX_MODE; /* --approx: the coeffecients from their logarithms */
+extern bool APPROX_PROB; /* --prob: divided by (|c1| + |c2| + ...)^n */
+extern bool STATS_MODE; /* --stats: sums up the terms, instead of printing them */
+extern bool BATCH_MODE; /* --batch: expands every line of stdin */
+extern int NR_JOBS;     /* -j: worker threads, 0 for one per cpu */
+
 void show_usage( char *prog_name);
 void show_help(void );
 int print_cmdln_child( int argc, char *argv[], int treshold, int *consumed, int arg_start );
@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "multinom.h"
+/*
+ * partcache.c
+ * ===========
+ *
+ * The multinomial coeffecient of a term only depends on the powers in it,
+ * not on which variables they belong to, so (3,1,0), (0,3,1) and (1,0,3)
+ * all have 4!/(3!1!0!). When variables have the same coeffecient, then the
+ * product of the coeffecients doesn't depend on which of them has which
+ * power either, so the whole coeffecient of x^3y and xy^3 in (x + y)^4 is
+ * the same.
+ *
+ * We put the variables with the same coeffecient in a class, and the key of
+ * a term is the powers of every class, sorted. That is the partition of n
+ * when there is only one class. Every key is computed once, and looked up
+ * in a hash table for the rest of the terms that has it.
+ */
+
+#define PC_EMPTY -1
+
+/* FNV-1a over the powers. */
+static unsigned long pc_hash( const int *key, int keylen )
+{
+    unsigned long h = 14695981039346656037UL;
+    for ( int i = 0; i < keylen; i++ ) {
+        h ^= ( unsigned long ) key[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static void *pc_alloc( void *ptr, size_t size )
+{
+    void *res = realloc( ptr, size );
+    if ( res == NULL ) {
+        expand_fail( "partcache: Out of memory\n" );
+    }
+    return res;
+}
+
+/**
+ * @brief Sets up the classes of variables with equal coeffecients, every
+ * class gets valsize bytes for its value. With coefftbl == NULL, all the
+ * variables are in one class, for just the multinomial coeffecients.
+ */
+void pc_init( partCache *pc, int nr_vars, int *coefftbl, size_t valsize )
+{
+    pc->keylen = nr_vars;
+    pc->valsize = valsize;
+    pc->nr_keys = 0;
+    pc->cap_keys = 0;
+    pc->keys = NULL;
+    pc->vals = NULL;
+    pc->nr_slots = 64;
+    pc->slots = pc_alloc( NULL, pc->nr_slots * sizeof( int ) );
+    for ( int s = 0; s < pc->nr_slots; s++ )
+        pc->slots[s] = PC_EMPTY;
+    pc->order = pc_alloc( NULL, nr_vars * sizeof( int ) );
+    pc->class_end = pc_alloc( NULL, nr_vars * sizeof( int ) );
+    pc->key = pc_alloc( NULL, nr_vars * sizeof( int ) );
+
+   /* The variables are ordered by class, in the order the classes first
+      occurs. */
+    bool *taken = pc_alloc( NULL, nr_vars * sizeof( bool ) );
+    memset( taken, 0, nr_vars * sizeof( bool ) );
+    int pos = 0;
+    pc->nr_classes = 0;
+    for ( int i = 0; i < nr_vars; i++ ) {
+        if ( taken[i] )
+            continue;
+        for ( int j = i; j < nr_vars; j++ ) {
+            if ( !taken[j] && ( coefftbl == NULL || coefftbl[j] == coefftbl[i] ) ) {
+                taken[j] = true;
+                pc->order[pos++] = j;
+            }
+        }
+        pc->class_end[pc->nr_classes++] = pos;
+    }
+    free( taken );
+}
+
+void pc_free( partCache *pc )
+{
+    free( pc->key );
+    free( pc->class_end );
+    free( pc->order );
+    free( pc->slots );
+    free( pc->vals );
+    free( pc->keys );
+}
+
+/* Doubles the hash table, when it gets half full. */
+static void pc_rehash( partCache *pc )
+{
+    free( pc->slots );
+    pc->nr_slots *= 2;
+    pc->slots = pc_alloc( NULL, pc->nr_slots * sizeof( int ) );
+    for ( int s = 0; s < pc->nr_slots; s++ )
+        pc->slots[s] = PC_EMPTY;
+    for ( int id = 0; id < pc->nr_keys; id++ ) {
+        unsigned long s = pc_hash( pc->keys + ( size_t ) id * pc->keylen, pc->keylen ) & ( pc->nr_slots - 1 );
+        while ( pc->slots[s] != PC_EMPTY )
+            s = ( s + 1 ) & ( pc->nr_slots - 1 );
+        pc->slots[s] = id;
+    }
+}
+
+/**
+ * @brief Finds the value of the class of the term with the powers in exps.
+ * @detail Returns a pointer to the value, that stays valid until the next
+ * call, *is_new tells if the caller has to compute the value, and store it
+ * there.
+ */
+void *pc_find( partCache *pc, const int *exps, bool *is_new )
+{
+    int *key = pc->key,
+        start = 0;
+
+   /* The powers of every class, in decreasing order, by insertion sort,
+      there are seldom many variables. */
+    for ( int c = 0; c < pc->nr_classes; c++ ) {
+        for ( int i = start; i < pc->class_end[c]; i++ ) {
+            int e = exps[pc->order[i]],
+                j = i;
+            while ( j > start && key[j - 1] < e ) {
+                key[j] = key[j - 1];
+                j--;
+            }
+            key[j] = e;
+        }
+        start = pc->class_end[c];
+    }
+
+    unsigned long s = pc_hash( key, pc->keylen ) & ( pc->nr_slots - 1 );
+    while ( pc->slots[s] != PC_EMPTY ) {
+        int id = pc->slots[s];
+        if ( memcmp( pc->keys + ( size_t ) id * pc->keylen, key, pc->keylen * sizeof( int ) ) == 0 ) {
+            *is_new = false;
+            return ( char * ) pc->vals + ( size_t ) id * pc->valsize;
+        }
+        s = ( s + 1 ) & ( pc->nr_slots - 1 );
+    }
+
+    if ( pc->nr_keys == pc->cap_keys ) {
+        pc->cap_keys = ( pc->cap_keys == 0 ) ? 64 : 2 * pc->cap_keys;
+        pc->keys = pc_alloc( pc->keys, ( size_t ) pc->cap_keys * pc->keylen * sizeof( int ) );
+        pc->vals = pc_alloc( pc->vals, ( size_t ) pc->cap_keys * pc->valsize );
+    }
+    int id = pc->nr_keys++;
+    memcpy( pc->keys + ( size_t ) id * pc->keylen, key, pc->keylen * sizeof( int ) );
+    pc->slots[s] = id;
+    if ( 2 * pc->nr_keys > pc->nr_slots )
+        pc_rehash( pc );
+    *is_new = true;
+    return ( char * ) pc->vals + ( size_t ) id * pc->valsize;
+}
+
+/* The value of class id, for freeing what the values points to. */
+void *pc_value( partCache *pc, int id )
+{
+    return ( char * ) pc->vals + ( size_t ) id * pc->valsize;
+}
@@ -24,10 +24,13 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <math.h>
+#include "multinom.h"
 /**
  * @file permtable.c  (based on baelditer.c)
  */
@@ -47,8 +50,6 @@ static void log_msg( const char *format, ... )
     va_end( args );
 }
 
-static unsigned fact_too_big_param = 0;
-
 /* 
  * Truly fixed detecting overflows and underflows  thanks to u/inz_ 
  * This can be done better I'm sure though, by bit counting.
@@ -69,8 +70,7 @@ int power( int base, int exp )
         int adj_base = ( base > 0 ) ? base : ( base * -1 );
         for ( int i = 1; i <= exp; i++ ) {
             if ( result > INT_MAX / adj_base ) {
-                fprintf( stderr, "power:" " integer overflow when raising" " base %d to exponent %d\n", base, exp );
-                exit( EXIT_FAILURE );
+                expand_fail( "power:" " integer overflow when raising" " base %d to exponent %d\n", base, exp );
                 break;
             } else {
                 result *= adj_base;
@@ -81,8 +81,7 @@ int power( int base, int exp )
         for ( int i = 1; i <= exp; i++ ) {
 
             if ( result < INT_MIN / pos_base ) {
-                fprintf( stderr, "power:" " integer underflow when raising" " base %d to exponent %d\n", base, exp );
-                exit( EXIT_FAILURE );
+                expand_fail( "power:" " integer underflow when raising" " base %d to exponent %d\n", base, exp );
                 break;
             } else {
                 result *= base;
@@ -97,55 +96,33 @@ int power( int base, int exp )
 }
 
 /*
- * We return with -1 when there is overflow.
- * Could count bits instead of the invariant with division.
- * Not sure if there are much to saved, and it isn't so precarious
- * here anyway. 
+ * The long version of power(), the coeffecients of decimals soon gets big,
+ * when the decimal point is taken away.
  */
-int factorial( unsigned n )
+long l_power( long base, int exp )
 {
-    unsigned tmp = n;
-    if ( n <= 1 ) {
-        return 1;
-    } else {
-        unsigned next = n - 1;
-        fact_too_big_param = n;
-        while ( n > 1 ) {
-            if ( tmp > UINT_MAX / next ) {
-                return -1;
-            } else {
-                tmp *= ( n - 1 );
-                --n;
-                next = ( n - 1 );
-            }
-        }
-    }
-   /* msb of tmp can't be set if we get here. implies that the UINT can be
-      casted to INT! */
-    return ( int ) tmp;
-}
+    assert( exp >= 0 );
 
-long l_factorial( unsigned n )
-{
-    unsigned long tmp = n;
-    if ( n <= 1 ) {
-        return 1L;
-    } else {
-        unsigned long next = n - 1;
-        fact_too_big_param = n;
-        while ( n > 1 ) {
-            if ( tmp > ULONG_MAX / next ) {
-                return -1L;
-            } else {
-                tmp *= ( n - 1 );
-                --n;
-                next = ( n - 1 );
-            }
+    long result = 1;
+
+    if ( exp == 0 )
+        return result;
+
+    if ( base == 0 )
+        return 0L;
+
+    long adj_base = ( base > 0 ) ? base : ( base * -1 );
+    for ( int i = 1; i <= exp; i++ ) {
+        if ( result > LONG_MAX / adj_base ) {
+            expand_fail( "l_power:" " integer overflow when raising" " base %ld to exponent %d\n", base, exp );
+        } else {
+            result *= adj_base;
         }
     }
-   /* msb of tmp can't be set if we get here. implies that the ULONG can be
-      casted to LONG! */
-    return ( long ) tmp;
+    if ( base < 0 && exp % 2 ) {
+        result *= -1;
+    }
+    return result;
 }
 
 /**
@@ -153,133 +130,118 @@ long l_factorial( unsigned n )
  * @detail
  *
  * c(n,r) == n!/(r!*(n-r)!)
- * if n>=r && fact(n) > -1  we're okay!
  *
- * There is more that doesn't make sense here, if r > n. f.ex.
- * It should be taken care of before trying to get factorials.
- * A too large parameter for factorial being another.
- * Return value in this case should be -1 too.
+ * computed as n/1 * (n-1)/2 * ... so every step is exact, and there is
+ * no need for the factorials, that overflowed when n > 20.
+ * Returns -1 when the result is bigger than an int.
  *
  */
 static int c( int n, int r )
 {
     assert( r <= n );
-    if ( n == 0 )
-        return 1;
-    if ( r == 0 )
-        return 1; /* there is just one combination of zero elements. */
-
-
-    long ntmp = l_factorial( n );
-    if ( ntmp == -1 ) {
-        fprintf( stderr, "c(): integer overflow; value of n too big: %d exponent == %d\n", n, fact_too_big_param );
-        return -1;
-    }
-    long rtmp = l_factorial( r ),
-        nminusrtmp = l_factorial( n - r );
-
-    ntmp /= rtmp;
-    ntmp /= nminusrtmp;
-    if ( ntmp < INT_MAX ) {
-        return ntmp;
-    } else {
-        return -1;
+    if ( r > n - r )
+        r = n - r; /* c(n,r) == c(n,n-r), and fewer steps. */
+
+    long res = 1;
+    for ( int i = 1; i <= r; i++ ) {
+        res = res * ( n - r + i ) / i;
+        if ( res > INT_MAX )
+            return -1;
     }
+    return ( int ) res;
 }
 
-/* https://www.baeldung.com/cs/permutations-with-repetition */
 /**
- * @brief Generates the nextt permutation with repetition.
- * @detail Much like lexically ordered permutations, but 
- * here we change the order "odometer-wise".
- * There are 'k' positions in the buffer.
+ * @brief Fills x[from..k-1] with the largest composition of rest, in lexical
+ * order, that keeps every x[i] <= bounds[i].
+ * @detail The caller makes sure that room[from] >= rest, so it always fits.
  */
-static int *next( int *x, int n, int k )
+static void fill_suffix( int *x, int k, int from, int rest, int *bounds )
 {
-   /* Find the suffix to change. */
-    int j = k - 1; /* last position! */
-    while ( j >= 0 && x[j] == n )
-        j--;
-
-    if ( j == -1 )
-        return NULL; /* x was the last permutation */
-
-
-   /* Change the suffix. */
-    for ( int l = j; l < k; l++ ) {
-        if ( x[l] == n )
-            x[l] = 0;
-        else
-            x[l]++;
+    for ( int i = from; i < k; i++ ) {
+        x[i] = ( rest < bounds[i] ) ? rest : bounds[i];
+        rest -= x[i];
     }
-
-    return x;
-
 }
 
-static bool processed( int *x, int n, int k, int *coefftbl, int sres_idx )
+/**
+ * @brief Generates the compositions of n into k parts, where part i is
+ * at most bounds[i], straight into the terms_table, nr_rows of them from the
+ * one in p_buffer.
+ * @detail
+ * The compositions comes in decreasing lexical order, starting with
+ * x^n, which is the order the terms are printed in.
+ * room[i] is how much of n the positions i..k-1 can take together, so we
+ * never decrease a position, unless the rest of the buffer can take up the
+ * difference, and the subtrees that can't add up to n, are never visited.
+ * Since the table was sized by the number of compositions that fits within
+ * the bounds, there is one row for every composition we generate.
+ *
+ * INPUT
+ * n = the exponent to which the multinomial is raised/expanded to.
+ * k = the number of parts in a composition (nr_vars).
+ */
+static void perm_term_tbl( int k, long nr_rows, int *terms_table, int *bounds, int *room, int *p_buffer )
 {
-   /* 
-    * The table is now stack, so we need to treat the area
-    * as a stack.
-    * maybe easy if everything inside a struct.
-    *
-    * if cross sum of x == k (power to whichh multinomial is raised.
-    * assign row correctly in reverse list.
-    * LATER:
-    * Calculatate multinomial coeffecient.
-    * place multinomial coeffecient correctly in reverse list.
-   */
-
-    bool passed = false;
-    bool dbg_show = false;
-    int cross_sum = 0;
-    for ( int i = 0; i < k; i++ )
-        if ( i == 0 )
-            cross_sum = x[i];
-        else
-            cross_sum += x[i];
-
-    if ( cross_sum == n ) {
-        passed = true;
-       /* calc of multinomial coeffecient happens later! */
-        if ( dbg_show ) {
-            for ( int i = 0; i < k; i++ )
-                printf( "%2d ", x[i] );
-            printf( "\n" );
-        }
-        int *tbl_ofs = coefftbl + ( sres_idx * ( k + 1 ) );
+    long row = 0;
+
+    for ( ;; ) {
+        int *tbl_ofs = terms_table + ( row++ * ( k + 1 ) );
         for ( int i = 0; i < k; i++ )
-            tbl_ofs[i] = x[i];
+            tbl_ofs[i] = p_buffer[i];
+        if ( row == nr_rows )
+            break;
+        if ( row % TRACE_ROWS == 0 )
+            TRACE( permtable_progress, row, nr_rows );
+
+       /* The rightmost position, that can give one to the positions after it. */
+        int j = k - 2,
+            suffix = p_buffer[k - 1];
+        while ( j >= 0 && ( p_buffer[j] == 0 || suffix + 1 > room[j + 1] ) ) {
+            suffix += p_buffer[j];
+            j--;
+        }
+        assert( j >= 0 ); /* there is a row for every composition */
+        p_buffer[j]--;
+        fill_suffix( p_buffer, k, j + 1, suffix + 1, bounds );
     }
-    return passed;
+    LOG( "%ld compositions into %d parts\n", row, k );
 }
 
-static void perm_term_tbl( int k, int n, int *coefftbl, int sres_idx, int *p_buffer )
+/**
+ * @brief Counts the compositions of n into k parts, where part i is at most
+ * bounds[i].
+ * @detail
+ * ways[r] is the number of ways the positions after the current one, can
+ * add up to r. Every step adds a position in front, whose part may be
+ * anything from 0 to its bound. Returns -1 if the count is bigger than INT_MAX.
+ */
+static int bounded_rows( int k, int n, int *bounds )
 {
-
-   /* INPUT
-    * n = the set cardinality, the number of powers upto and including n.
-    * n happens to be the exponent to which the multinomial is raised/expanded to.
-    * k = the length of permutations with repetition (nr_vars).
-    * OUTPUT
-    * All the k-tuples of the set {1,2,...,n} are processed
-    * and all the k-tuples with a cross-sum of n is inserted into the coefftbl by
-    * processed().
-    */
-
-    doprint = false;
-    while ( sres_idx >= 0 && p_buffer != NULL ) {
-        LOG( "%2d %2d %2d\n", p_buffer[0], p_buffer[1], p_buffer[2] );
-        if ( processed( p_buffer, n, k, coefftbl, sres_idx ) )
-            sres_idx--;
-
-        p_buffer = next( p_buffer, n, k ); 
-        /* Next permutation to processe. */
+    long *ways = calloc( n + 1, sizeof( long ) );
+    long *prefix = calloc( n + 2, sizeof( long ) );
+    if ( ways == NULL || prefix == NULL ) {
+        expand_fail( "bounded_rows: Out of memory\n" );
+    }
+    ways[0] = 1;
+    for ( int i = k - 1; i >= 0; i-- ) {
+        prefix[0] = 0;
+        for ( int r = 0; r <= n; r++ )
+            prefix[r + 1] = prefix[r] + ways[r];
+        for ( int r = 0; r <= n; r++ ) {
+            int lowest = ( r - bounds[i] > 0 ) ? r - bounds[i] : 0;
+            ways[r] = prefix[r + 1] - prefix[lowest];
+           /* Anything bigger than INT_MAX is just too big, we don't care how much. */
+            if ( ways[r] > INT_MAX )
+                ways[r] = ( long ) INT_MAX + 1;
+        }
     }
+    long rows = ways[n];
+    free( prefix );
+    free( ways );
+    return ( rows > INT_MAX ) ? -1 : ( int ) rows;
 }
 
-
 /**
  * The number of rows we need for the coeffecient table
  * is how many rows there are of permutations, with the cross sum
@@ -299,30 +261,236 @@ static void perm_term_tbl( int k, int n, int *coefftbl, int sres_idx, int *p_buf
  *     } 
  */
 
-static void calc_multinom_coeff( int nr_vars, int mnom_dividend, int *terms_table, int nr_rows )
+/* Every multinomial coeffecient is at most nr_vars^exponent, since they add
+ * up to that. */
+static bool mnom_fits_int( int nr_vars, int exponent )
 {
-   /* All values are supposed to be smalller or equal to exponent. so, no need
-      to check return value of factorial for overflow.  */
-
-    for ( int i = 0; i < nr_rows; i++ ) {
-        int mnom_divisor = 1;
+    long max_mnom = 1;
+    for ( int i = 0; i < exponent; i++ ) {
+        max_mnom *= nr_vars;
+        if ( max_mnom > INT_MAX )
+            return false;
+    }
+    return true;
+}
 
+/*
+ * Fills in the last column of every row with the multinomial coeffecient,
+ * if they all fits in an int, then there is no need to check anything, and
+ * the coeffecient is built by exact binomial steps, like in c(), once for
+ * every partition of the exponent, the rows with the same powers in another
+ * order gets it from the cache pc. Otherwise the column is MNOM_TOO_BIG, and
+ * the coeffecients are computed with the width of integers chosen by
+ * coeff_width() when they are needed.
+ */
+static void calc_multinom_coeff( int nr_vars, int exponent, int *terms_table, long nr_rows, partCache *pc )
+{
+    TRACE( coeff_start, nr_vars, exponent, nr_rows );
+    if ( !mnom_fits_int( nr_vars, exponent ) ) {
+        for ( long i = 0; i < nr_rows; i++ )
+            terms_table[i * ( nr_vars + 1 ) + nr_vars] = MNOM_TOO_BIG;
+        TRACE( coeff_done, nr_vars, exponent, nr_rows, 0 );
+        return;
+    }
+    for ( long i = 0; i < nr_rows; i++ ) {
+        int *row = terms_table + ( i * ( nr_vars + 1 ) );
+        bool is_new;
+        int *cached = pc_find( pc, row, &is_new );
+        long mnom = 1;
+        int left = exponent;
+
+        if ( !is_new ) {
+            row[nr_vars] = *cached;
+            continue;
+        }
         for ( int j = 0; j < nr_vars; j++ ) {
-            int tmp = factorial( *( terms_table + ( i * ( nr_vars + 1 ) + j ) ) );
-            if ( tmp > INT_MAX / mnom_divisor ) {
-                int cur_pwr = *( terms_table + ( i * ( nr_vars + 1 ) + j ) );
-                fprintf( stderr,
-                         "Error: Int overflow in calc_multinom_coeff."
-                         " cur_ exponent == %d mnom_divisor == %d\n", cur_pwr, mnom_divisor );
-                exit( EXIT_FAILURE );
-            } else {
-                mnom_divisor *= tmp;
+            long binom = 1;
+            for ( int m = 1; m <= row[j]; m++ )
+                binom = binom * ( left - m + 1 ) / m;
+            mnom *= binom;
+            left -= row[j];
+        }
+        row[nr_vars] = *cached = ( int ) mnom;
+    }
+    LOG( "%d partitions of %d for %ld rows\n", pc->nr_keys, exponent, nr_rows );
+    TRACE( coeff_done, nr_vars, exponent, nr_rows, pc->nr_keys );
+}
+
+/* What the workers of mk_permtable() shares. */
+typedef struct {
+    int k, n;
+    int *terms_table, *bounds, *room;
+    long first;             /* the row of the expansion the table starts with */
+    termIndex ti;           /* to find the row a worker starts from */
+} permJob;
+
+/* Every worker has a buffer to permute, and a cache of its own. */
+typedef struct {
+    int *p_buffer;
+    partCache pc;
+} permState;
+
+static void *perm_init( void *ctx )
+{
+    permJob *job = ctx;
+    permState *st = malloc( sizeof( permState ) );
+    if ( st == NULL || ( st->p_buffer = calloc( job->k, sizeof( int ) ) ) == NULL ) {
+        expand_fail( "perm_buffer: Out of memory\n" );
+    }
+    pc_init( &st->pc, job->k, NULL, sizeof( int ) );
+    return st;
+}
+
+/* The rows lo..hi-1 of the table, from the composition of its row lo. */
+static void perm_leaf( void *ctx, void *local, long lo, long hi, void **part )
+{
+    permJob *job = ctx;
+    permState *st = local;
+    int *rows = job->terms_table + lo * ( job->k + 1 );
+
+    ( void ) part;
+    TRACE( permtable_chunk, lo, hi );
+    ti_unrank( &job->ti, job->first + lo, st->p_buffer );
+    perm_term_tbl( job->k, hi - lo, rows, job->bounds, job->room, st->p_buffer );
+    calc_multinom_coeff( job->k, job->n, rows, hi - lo, &st->pc );
+}
+
+static void perm_fini( void *ctx, void *local )
+{
+    permState *st = local;
+    ( void ) ctx;
+    pc_free( &st->pc );
+    free( st->p_buffer );
+    free( st );
+}
+
+static const wsOps perm_ops = { perm_init, perm_leaf, NULL, perm_fini };
+
+static const char *const order_names[] = { "lex", "grlex", "revlex", "grevlex" };
+
+/* The term_order of the name, or -1 if there is no such order. */
+int perm_order( const char *name )
+{
+    for ( size_t o = 0; o < sizeof( order_names ) / sizeof( order_names[0] ); o++ )
+        if ( strcmp( order_names[o], name ) == 0 )
+            return ( int ) o;
+    return -1;
+}
+
+/* Turns the rows of the table, made with the variables in the reverse
+ * order, back to the order of the variables, and turns the table upside
+ * down when rev_rows is true. */
+static void order_rows( int k, int nr_rows, int *terms_table, bool rev_vars, bool rev_rows )
+{
+    int *row, *last, tmp;
+
+    if ( rev_vars ) {
+        for ( row = terms_table; row < terms_table + ( long ) nr_rows * ( k + 1 ); row += k + 1 ) {
+            for ( int i = 0, j = k - 1; i < j; i++, j-- ) {
+                tmp = row[i];
+                row[i] = row[j];
+                row[j] = tmp;
             }
         }
+    }
+    if ( rev_rows ) {
+        row = terms_table;
+        last = terms_table + ( long ) ( nr_rows - 1 ) * ( k + 1 );
+        for ( ; row < last; row += k + 1, last -= k + 1 ) {
+            for ( int i = 0; i <= k; i++ ) {
+                tmp = row[i];
+                row[i] = last[i];
+                last[i] = tmp;
+            }
+        }
+    }
+}
+
+/**
+ * @brief The number of bits that is enough for the coeffecient of any term,
+ * sign included.
+ * @detail
+ * By the multinomial theorem, the sum of all the coeffecients with the signs
+ * taken away is ( |c1| + |c2| + ... + |ck| )^n, so no term can be bigger
+ * than that. We count every coeffecient as at least 1, so that the bound
+ * covers the multinomial coeffecients too, and add the bits of n, since the
+ * binomial steps multiply with up to n, before they divide.
+ */
+double coeff_bound_bits( int nr_vars, int exponent, int *coefftbl )
+{
+    double sum = 0.0;
+    for ( int i = 0; i < nr_vars; i++ ) {
+        long abs_coeff = labs( ( long ) coefftbl[i] );
+        sum += ( abs_coeff > 1 ) ? ( double ) abs_coeff : 1.0;
+    }
+    return exponent * log2( sum ) + log2( exponent + 1.0 ) + 2.0;
+}
+
+/**
+ * @brief Chooses the width of the integers, we need to compute the
+ * coeffecients of the terms with, before expanding.
+ */
+arith_width coeff_width( int nr_vars, int exponent, int *coefftbl )
+{
+    double bits = coeff_bound_bits( nr_vars, exponent, coefftbl );
+
+    if ( bits < 63.0 )
+        return W_LONG;
+#ifdef __SIZEOF_INT128__
+    if ( bits < 127.0 )
+        return W_INT128;
+#endif
+    return W_BIG;
+}
+
+/**
+ * @brief The multinomial coeffecient n!/(e1! * e2! * ... * ek!) of one term,
+ * computed as a product of binomial coeffecients, so that every step is
+ * exact, and we don't need the factorials.
+ * @detail Returns -1 if it doesn't fit in a long.
+ */
+long l_multinom( int nr_vars, int exponent, int *exps )
+{
+    long mnom = 1;
+    int left = exponent;
 
-        *( terms_table + ( i * ( nr_vars + 1 ) + nr_vars ) ) = mnom_dividend / mnom_divisor;
+    for ( int i = 0; i < nr_vars; i++ ) {
+        long binom = 1;
+        for ( int j = 1; j <= exps[i]; j++ ) {
+            if ( binom > LONG_MAX / ( left - j + 1 ) )
+                return -1L;
+            binom = binom * ( left - j + 1 ) / j;
+        }
+        if ( mnom > LONG_MAX / binom )
+            return -1L;
+        mnom *= binom;
+        left -= exps[i];
     }
+    return mnom;
+}
 
+/**
+ * @brief The coeffecient of one term, the multinomial coeffecient times the
+ * coeffecients of the variables, raised to their powers in the term.
+ * @detail The coefftbl must have been adjusted with adjust_coeffs(), we
+ * exit if the coeffecient doesn't fit in a long.
+ */
+long l_term_coeff( int nr_vars, int exponent, int *exps, int *coefftbl )
+{
+    long coeff = l_multinom( nr_vars, exponent, exps );
+    if ( coeff == -1 ) {
+        expand_fail( "l_term_coeff: Long overflow in the multinomial coeffecient.\n" );
+    }
+    for ( int i = 0; i < nr_vars; i++ ) {
+        if ( exps[i] > 0 && coefftbl[i] != 1 ) {
+            long tmp = l_power( coefftbl[i], exps[i] );
+            if ( tmp != 0 && labs( coeff ) > LONG_MAX / labs( tmp ) ) {
+                expand_fail( "l_term_coeff: Long overflow in the coeffecient of a term.\n" );
+            }
+            coeff *= tmp;
+        }
+    }
+    return coeff;
 }
 
 #if 0 == 1
@@ -340,66 +508,113 @@ void print_term_tbl( int nr_vars, int exponent, int *terms_table, int nr_rows )
 
 }
 #endif 
-void exponent_err( void )
-{
-    fflush( stdout );
-    fprintf( stderr, "\nExponent too big to calculate the factorial of: was: %u, needs to exit.\n", fact_too_big_param );
-}
 /**
  * @brief Generates the table with multinomial coeffecients that satisfies
  * the condition that the cross sum of the row equals the power of the multinomial,
- * IN REVERSE ORDER, so the terms comes out correctly in the end.
+ * in the order the terms are to be printed.
+ * @detail
+ * If bounds isn't NULL, then it holds the maximum power of every variable,
+ * and only the terms within the bounds makes it into the table, that is
+ * sized after the number of such terms. There may be none.
+ * The table is just shard of nr_shards even slices of the rows, when
+ * nr_shards > 1, and first gets the number of the row it starts with.
+ *
+ * The rows comes in the TERM_ORDER. Every term has the degree n, so grlex
+ * is lex. revlex is lex with the variables read from the last one, so the
+ * table is made like that, with the bounds reversed, and the parts of
+ * every row are turned around, and grevlex, where the lowest power of the
+ * last variable comes first, is revlex upside down, so a slice of it is
+ * the mirrored slice of revlex turned upside down. It is O(1) per term, and
+ * the slices and chunks streams just as well as the lex ones.
  */
-int mk_permtable( int nr_vars, int exponent, int **terms_table )
+int mk_permtable( int nr_vars, int exponent, int *bounds, int shard, int nr_shards, long *first,
+                  int **terms_table )
 {
    /* Create the buffer we permute. */
     assert( nr_vars > 1 && exponent > 0 );
+    TRACE( permtable_start, nr_vars, exponent );
     int *perm_buffer = calloc( nr_vars, sizeof( int ) );
-    if ( perm_buffer == NULL ) {
-        fprintf( stderr, "perm_buffer: Out of memory, exiting\n" );
-        exit( EXIT_FAILURE );
+    int *lim = calloc( nr_vars, sizeof( int ) );
+    int *room = calloc( nr_vars + 1, sizeof( int ) );
+    if ( perm_buffer == NULL || lim == NULL || room == NULL ) {
+        expand_fail( "perm_buffer: Out of memory\n" );
+    }
+    bool rev_vars = ( TERM_ORDER == ORD_REVLEX || TERM_ORDER == ORD_GREVLEX ),
+        rev_rows = ( TERM_ORDER == ORD_GREVLEX );
+   /* No variable can have a higher power than the exponent anyway. */
+    for ( int i = nr_vars - 1; i >= 0; i-- ) {
+        int v = rev_vars ? nr_vars - 1 - i : i;
+        lim[i] = ( bounds != NULL && bounds[v] < exponent ) ? bounds[v] : exponent;
+        room[i] = ( room[i + 1] + lim[i] < exponent ) ? room[i + 1] + lim[i] : exponent;
     }
-
-    perm_buffer[nr_vars - 1] = exponent; // seed the buffer with start value
 
    /*
     * Calculate number of rows in the terms_table which contains the
     * power for the variables and the multinom coeff for the term.
     */
     int rows_termtbl;
-    rows_termtbl = c( ( nr_vars + exponent - 1 ), exponent );
+    if ( bounds == NULL ) {
+        rows_termtbl = c( ( nr_vars + exponent - 1 ), exponent );
+    } else {
+        rows_termtbl = bounded_rows( nr_vars, exponent, lim );
+    }
     if ( rows_termtbl == -1 ) {
+        free( room );
+        free( lim );
         free( perm_buffer );
         fprintf( stderr, "mk_permtable: Integer overflow while computing number of factors.\n" );
         fprintf( stderr, "mk_permtable: The combination of the exponent (%d), and"
                  " the number of variables (%d) is too large.\n", exponent, nr_vars );
         return -1;
     }
+    long total = rows_termtbl,
+        from = total * shard / nr_shards;
+    rows_termtbl = ( int ) ( total * ( shard + 1 ) / nr_shards - from );
+    if ( first != NULL )
+        *first = from;
+    if ( rev_rows )
+        from = total - from - rows_termtbl; /* the mirrored slice */
+    if ( rows_termtbl == 0 ) {
+       /* The bounds leaves nothing of the expansion, or of the shard. */
+        *terms_table = NULL;
+        free( room );
+        free( lim );
+        free( perm_buffer );
+        return 0;
+    }
    /* Allocate memory for the terms_table. */
     *terms_table = calloc( ( rows_termtbl * ( nr_vars + 1 ) ), sizeof( int ) );
-    if ( terms_table == NULL ) {
-        fprintf( stderr, "terms_table: Out of memory, exiting\n" );
-        exit( EXIT_FAILURE );
+    if ( *terms_table == NULL ) {
+        expand_fail( "terms_table: Out of memory\n" );
     }
 
-    int last_term_idx = ( rows_termtbl - 1 ); 
-    /* we fill in the terms_table from bottom. so the permu
-     * are ordered in reverse, which is correct in our case. 
-     */
-
-    perm_term_tbl( nr_vars, exponent, *terms_table, last_term_idx, perm_buffer );
-
-    int mnom_dividend = factorial( exponent );
-    if ( mnom_dividend == -1 ) {
-        free( *terms_table );
-        free( perm_buffer );
-        exponent_err(  );
-        return -1;
+    int nr_threads = ws_threads( rows_termtbl );
+    permJob job = { nr_vars, exponent, *terms_table, lim, room, from, { 0 } };
+    bool indexed = ( nr_threads > 1 || from > 0 ) && ti_init( &job.ti, nr_vars, exponent, lim );
+    if ( indexed && nr_threads > 1 ) {
+       /* The workers starts anywhere in the table, from the row unranked. */
+        ws_run( rows_termtbl, ws_grain( rows_termtbl, nr_threads ), nr_threads, &perm_ops, &job );
+    } else if ( from > 0 && !indexed ) {
+        expand_fail( "mk_permtable: Too many terms to find the start of the shard.\n" );
+    } else {
+        partCache pc;
+        if ( from > 0 )
+            ti_unrank( &job.ti, from, perm_buffer );
+        else
+            fill_suffix( perm_buffer, nr_vars, 0, exponent, lim );
+        perm_term_tbl( nr_vars, rows_termtbl, *terms_table, lim, room, perm_buffer );
+        pc_init( &pc, nr_vars, NULL, sizeof( int ) );
+        calc_multinom_coeff( nr_vars, exponent, *terms_table, rows_termtbl, &pc );
+        pc_free( &pc );
     }
+    if ( indexed )
+        ti_free( &job.ti );
+    order_rows( nr_vars, rows_termtbl, *terms_table, rev_vars, rev_rows );
 
-    calc_multinom_coeff( nr_vars, mnom_dividend, *terms_table, rows_termtbl );
-
+    free( room );
+    free( lim );
     free( perm_buffer );
+    TRACE( permtable_done, nr_vars, exponent, rows_termtbl );
     return rows_termtbl;
 
 }
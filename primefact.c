@@ -0,0 +1,256 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "multinom.h"
+/*
+ * primefact.c
+ * ===========
+ *
+ * The coeffecients of the terms as products of primes, for the exponents
+ * where the bignums gets long. No prime bigger than n divides n!, so
+ *
+ *      n! / ( e1! * ... * ek! ) * c1^e1 * ... * ck^ek
+ *
+ * is a product of the primes up to n, and the primes of the coeffecients,
+ * and we keep the power of every prime in a vector. The power of p in n! is
+ * the sum of the powers of p in 2, 3, ..., n (Legendre), so when the power
+ * of a variable goes from a to b, we just add or take away the factors of
+ * the numbers between them, with the smallest prime factors from a sieve
+ * made once. The neighbouring terms seldom differ much, so that is cheap.
+ *
+ * The integer is only made when it is printed: the primes are packed into
+ * 32 bit words, that are multiplied together pairwise, in a balanced tree,
+ * so the big multiplications are of numbers of about the same size.
+ */
+
+#define PF_WORD 4294967296ULL  /* 2^32 */
+
+static void *pf_alloc( size_t size )
+{
+    void *res = calloc( 1, size );
+    if ( res == NULL ) {
+        expand_fail( "primefact: Out of memory\n" );
+    }
+    return res;
+}
+
+/* Adds the index of a prime of a coeffecient, that is bigger than n. */
+static int pf_add_prime( primeTerm *pt, uint32_t p )
+{
+    for ( int j = pt->nr_small; j < pt->nr_primes; j++ )
+        if ( pt->primes[j] == p )
+            return j;
+    pt->primes[pt->nr_primes] = p;
+    return pt->nr_primes++;
+}
+
+/**
+ * @brief Sieves the primes up to exponent, and factors the coeffecients,
+ * the current term is all zero powers, with only n! in the vector.
+ * @detail The coefftbl must have been adjusted with adjust_coeffs().
+ */
+void pf_init( primeTerm *pt, int nr_vars, int exponent, int *coefftbl )
+{
+    int n = exponent;
+
+    pt->nr_vars = nr_vars;
+    pt->coefftbl = coefftbl;
+    pt->spf = pf_alloc( ( n + 1 ) * sizeof( int ) );
+    pt->prime_idx = pf_alloc( ( n + 1 ) * sizeof( int ) );
+    pt->exps = pf_alloc( nr_vars * sizeof( int ) );
+
+   /* The smallest prime factor of every number up to n. */
+    pt->nr_small = 0;
+    for ( int m = 2; m <= n; m++ ) {
+        if ( pt->spf[m] != 0 )
+            continue;
+        pt->prime_idx[m] = pt->nr_small++;
+        for ( long q = m; q <= n; q += m )
+            if ( pt->spf[q] == 0 )
+                pt->spf[q] = m;
+    }
+   /* Every coeffecient has at most 31 prime factors. */
+    int max_primes = pt->nr_small + 31 * nr_vars;
+    pt->primes = pf_alloc( max_primes * sizeof( uint32_t ) );
+    pt->vec = pf_alloc( max_primes * sizeof( long ) );
+    for ( int m = 2; m <= n; m++ )
+        if ( pt->spf[m] == m )
+            pt->primes[pt->prime_idx[m]] = m;
+    pt->nr_primes = pt->nr_small;
+
+   /* The prime factors of the coeffecients, as pairs of an index into
+      primes and the power, ending with -1. */
+    pt->coeff_fact = pf_alloc( nr_vars * 32 * 2 * sizeof( int ) );
+    for ( int v = 0; v < nr_vars; v++ ) {
+        int *fact = pt->coeff_fact + v * 64;
+        long c = labs( ( long ) coefftbl[v] );
+        for ( long p = 2; c > 1; p++ ) {
+            if ( p * p > c )
+                p = c; /* what is left is a prime */
+            if ( c % p != 0 )
+                continue;
+            int mult = 0;
+            while ( c % p == 0 ) {
+                c /= p;
+                mult++;
+            }
+            *fact++ = ( p <= n ) ? pt->prime_idx[p] : pf_add_prime( pt, ( uint32_t ) p );
+            *fact++ = mult;
+        }
+        *fact = -1;
+    }
+
+   /* n! */
+    for ( int m = 2; m <= n; m++ )
+        for ( int q = m; q > 1; q /= pt->spf[q] )
+            pt->vec[pt->prime_idx[pt->spf[q]]]++;
+
+    pt->nr_leaves = 0;
+    pt->leaves = pf_alloc( ( pt->nr_primes + 1 ) * sizeof( bigNum ) );
+    pt->cap_leaves = pt->nr_primes + 1;
+    pt->words = NULL;
+    pt->cap_words = 0;
+    big_init( &pt->scratch );
+}
+
+void pf_free( primeTerm *pt )
+{
+    for ( int i = 0; i < pt->cap_leaves; i++ )
+        big_free( &pt->leaves[i] );
+    big_free( &pt->scratch );
+    free( pt->leaves );
+    free( pt->words );
+    free( pt->coeff_fact );
+    free( pt->vec );
+    free( pt->primes );
+    free( pt->exps );
+    free( pt->prime_idx );
+    free( pt->spf );
+}
+
+/**
+ * @brief Moves the vector to the term with the powers in exps, by the
+ * differences from the current term.
+ */
+void pf_move_to( primeTerm *pt, const int *exps )
+{
+    for ( int v = 0; v < pt->nr_vars; v++ ) {
+        int from = pt->exps[v],
+            to = exps[v];
+        if ( from == to )
+            continue;
+       /* e! is in the denominator. */
+        int lo = ( from < to ) ? from : to,
+            hi = ( from < to ) ? to : from,
+            sign = ( from < to ) ? -1 : 1;
+        for ( int m = lo + 1; m <= hi; m++ )
+            for ( int q = m; q > 1; q /= pt->spf[q] )
+                pt->vec[pt->prime_idx[pt->spf[q]]] += sign;
+       /* c^e in the numerator. */
+        for ( int *fact = pt->coeff_fact + v * 64; *fact != -1; fact += 2 )
+            pt->vec[fact[0]] += ( long ) ( to - from ) * fact[1];
+        pt->exps[v] = to;
+    }
+}
+
+/**
+ * @brief The coeffecient of the current term, multiplied together from the
+ * vector with a product tree.
+ */
+void pf_value( primeTerm *pt, bigNum *res )
+{
+    bool neg = false;
+
+    for ( int v = 0; v < pt->nr_vars; v++ ) {
+        if ( pt->exps[v] == 0 )
+            continue;
+        if ( pt->coefftbl[v] == 0 ) {
+            big_set( res, 0L );
+            return;
+        }
+        if ( pt->coefftbl[v] < 0 && pt->exps[v] % 2 )
+            neg = !neg;
+    }
+
+   /* The primes, packed into words of 32 bits. */
+    int nr_words = 0;
+    uint64_t word = 1;
+    for ( int j = 0; j < pt->nr_primes; j++ ) {
+        for ( long k = 0; k < pt->vec[j]; k++ ) {
+            if ( word * pt->primes[j] >= PF_WORD ) {
+                if ( nr_words == pt->cap_words ) {
+                    pt->cap_words = ( pt->cap_words == 0 ) ? 64 : 2 * pt->cap_words;
+                    pt->words = realloc( pt->words, pt->cap_words * sizeof( uint32_t ) );
+                    if ( pt->words == NULL ) {
+                        expand_fail( "primefact: Out of memory\n" );
+                    }
+                }
+                pt->words[nr_words++] = ( uint32_t ) word;
+                word = 1;
+            }
+            word *= pt->primes[j];
+        }
+    }
+    if ( nr_words == 0 ) {
+        big_set( res, neg ? -( long ) word : ( long ) word );
+        return;
+    }
+
+   /* Pairs of words are the leaves of the tree, and then every level
+      multiplies the neighbours together, until there is one left. */
+    int nr_leaves = ( nr_words + 2 ) / 2;
+    if ( nr_leaves > pt->cap_leaves ) {
+        bigNum *leaves = realloc( pt->leaves, nr_leaves * sizeof( bigNum ) );
+        if ( leaves == NULL ) {
+            expand_fail( "primefact: Out of memory\n" );
+        }
+        for ( int i = pt->cap_leaves; i < nr_leaves; i++ )
+            big_init( &leaves[i] );
+        pt->leaves = leaves;
+        pt->cap_leaves = nr_leaves;
+    }
+    for ( int i = 0; i < nr_leaves; i++ ) {
+        uint64_t lo = ( 2 * i < nr_words ) ? pt->words[2 * i] : word,
+            hi = ( 2 * i + 1 < nr_words ) ? pt->words[2 * i + 1] : ( 2 * i + 1 == nr_words ) ? word : 1;
+        big_set( &pt->leaves[i], ( long ) lo );
+        big_mul_small( &pt->leaves[i], ( long ) hi );
+    }
+    for ( int len = nr_leaves; len > 1; len = ( len + 1 ) / 2 ) {
+        for ( int i = 0; i < len / 2; i++ ) {
+            big_mul( &pt->scratch, &pt->leaves[2 * i], &pt->leaves[2 * i + 1] );
+            bigNum tmp = pt->leaves[i];
+            pt->leaves[i] = pt->scratch;
+            pt->scratch = tmp;
+        }
+        if ( len % 2 ) {
+            bigNum tmp = pt->leaves[len / 2];
+            pt->leaves[len / 2] = pt->leaves[len - 1];
+            pt->leaves[len - 1] = tmp;
+        }
+    }
+    big_copy( res, &pt->leaves[0] );
+    res->neg = neg;
+}
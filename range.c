@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include "multinom.h"
+/*
+ * range.c
+ * =======
+ *
+ * The powers 1..n of the multinomial, with --range, every power from the
+ * one before it, instead of n expansions of their own.
+ *
+ * With i the first variable of a term e of (...)^m+1 with a power, the
+ * coeffecient of e follows from the one of e - u_i in (...)^m, where u_i is
+ * the power of one of variable i:
+ *
+ *      T(e) = T(e - u_i) * c_i * ( m + 1 ) / e_i
+ *
+ * since the multinomial coeffecient of e is (m+1)/e_i of the one of
+ * e - u_i, and the division is exact. In the order we print the terms, the
+ * terms with i as the first variable comes in a block, block i, and the
+ * e - u_i of block i are the terms of (...)^m without any of the variables
+ * before i, that is the S(m,i) last terms of (...)^m, in the same order,
+ * where S(m,i) is the number of terms of m into the variables i..k-1.
+ * So every power is made by copying the tails of the one before it, a term
+ * at the time, with a multiplication and a division.
+ */
+
+/* The terms of one of the powers. */
+typedef struct {
+    int nr_vars;
+    long nr_rows;
+    int *exps;                  /* the powers, nr_vars per row */
+    void *coeffs;               /* longs or bigNums */
+} rangePower;
+
+static void *range_alloc( size_t size, const char *what )
+{
+    void *ptr = malloc( size );
+    if ( ptr == NULL ) {
+        expand_fail( "range_expand: Out of memory for the %s\n", what );
+    }
+    return ptr;
+}
+
+/* coeff * mul / div, that is exact and fits in a long. If the product
+ * doesn't, we divide by what coeff and div has in common first. */
+static long mul_div_long( long coeff, long mul, long div )
+{
+    if ( mul == 0 || labs( coeff ) <= LONG_MAX / labs( mul ) )
+        return coeff * mul / div;
+    long a = labs( coeff ),
+        b = div;
+    while ( b != 0 ) {
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    return ( coeff / a ) * ( mul / ( div / a ) );
+}
+
+/* The terms of one power, into a sink of its own. */
+static void print_power( out_format fmt, FILE *fp, char *vartable, int m, const rangePower *pw,
+                         int *scaletbl, bool big )
+{
+    int nr_vars = pw->nr_vars;
+    termSink *out = sink_power( fmt, fp, nr_vars, vartable, pw->nr_rows * ( nr_vars + 8.0 ), m );
+
+    for ( long r = 0; r < pw->nr_rows; r++ ) {
+        const int *exps = pw->exps + r * nr_vars;
+        int scale = 0;
+        for ( int v = 0; v < nr_vars; v++ )
+            scale += scaletbl[v] * exps[v];
+        if ( big ) {
+            const bigNum *coeff = ( bigNum * ) pw->coeffs + r;
+            char *digits = big_to_digits( coeff );
+            sink_term( out, coeff->neg && !big_is_zero( coeff ), digits, scale, exps );
+            free( digits );
+        } else {
+            sink_term_long( out, ( ( long * ) pw->coeffs )[r], scale, exps );
+        }
+    }
+    sink_close( out );
+}
+
+/**
+ * @brief Prints the expansions of the powers 1..exponent, one after
+ * another, to fp.
+ * @detail The coefftbl must have been adjusted with adjust_coeffs(). The
+ * coeffecients are longs when the ones of the highest power fits, else
+ * bignums. Returns 0, or -1 if the highest power has too many terms.
+ */
+int range_expand( out_format fmt, FILE *fp, int nr_vars, char *vartable, int exponent,
+                  int *coefftbl, int *scaletbl )
+{
+    termIndex ti;
+    if ( !ti_init( &ti, nr_vars, exponent, NULL ) ) {
+        fprintf( stderr, "range_expand: The combination of the exponent (%d), and"
+                 " the number of variables (%d) is too large.\n", exponent, nr_vars );
+        return -1;
+    }
+    long max_rows = ti_count( &ti );
+    ti_free( &ti );
+
+    bool big = ( coeff_width( nr_vars, exponent, coefftbl ) != W_LONG );
+    size_t coeff_size = big ? sizeof( bigNum ) : sizeof( long );
+    long *tail = range_alloc( nr_vars * sizeof( long ), "counts" );
+    rangePower pw[2];
+    for ( int p = 0; p < 2; p++ ) {
+        pw[p].nr_vars = nr_vars;
+        pw[p].exps = range_alloc( max_rows * nr_vars * sizeof( int ), "powers" );
+        pw[p].coeffs = range_alloc( max_rows * coeff_size, "coeffecients" );
+        if ( big ) {
+            for ( long r = 0; r < max_rows; r++ )
+                big_init( ( bigNum * ) pw[p].coeffs + r );
+        }
+    }
+
+   /* (...)^0 is the one term 1, and S(0,i) == 1. */
+    pw[0].nr_rows = 1;
+    for ( int v = 0; v < nr_vars; v++ ) {
+        pw[0].exps[v] = 0;
+        tail[v] = 1;
+    }
+    if ( big )
+        big_set( pw[0].coeffs, 1L );
+    else
+        ( ( long * ) pw[0].coeffs )[0] = 1;
+
+    for ( int m = 0; m < exponent; m++ ) {
+        rangePower *old = &pw[m % 2],
+            *new = &pw[( m + 1 ) % 2];
+        long r = 0;
+
+        for ( int i = 0; i < nr_vars; i++ ) {
+            for ( long t = old->nr_rows - tail[i]; t < old->nr_rows; t++, r++ ) {
+                int *exps = new->exps + r * nr_vars;
+                for ( int v = 0; v < nr_vars; v++ )
+                    exps[v] = old->exps[t * nr_vars + v];
+                exps[i]++;
+                if ( big ) {
+                    bigNum *coeff = ( bigNum * ) new->coeffs + r;
+                    big_copy( coeff, ( bigNum * ) old->coeffs + t );
+                    big_mul_small( coeff, coefftbl[i] );
+                    big_mul_small( coeff, m + 1 );
+                    big_div_small( coeff, exps[i] );
+                } else {
+                    ( ( long * ) new->coeffs )[r] = mul_div_long( ( ( long * ) old->coeffs )[t],
+                                                               ( long ) coefftbl[i] * ( m + 1 ), exps[i] );
+                }
+            }
+        }
+        new->nr_rows = r;
+       /* S(m+1,i) == S(m,i) * ( k - i + m ) / ( m + 1 ) */
+        for ( int i = 0; i < nr_vars; i++ )
+            tail[i] = tail[i] * ( nr_vars - i + m ) / ( m + 1 );
+        print_power( fmt, fp, vartable, m + 1, new, scaletbl, big );
+    }
+
+    for ( int p = 0; p < 2; p++ ) {
+        if ( big ) {
+            for ( long r = 0; r < max_rows; r++ )
+                big_free( ( bigNum * ) pw[p].coeffs + r );
+        }
+        free( pw[p].coeffs );
+        free( pw[p].exps );
+    }
+    free( tail );
+    return 0;
+}
@@ -0,0 +1,659 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "multinom.h"
+/*
+ * sink.c
+ * ======
+ *
+ * Where the terms of the expansion goes. Every engine hands the terms it
+ * makes to sink_term(), one at the time, and the sink writes them in the
+ * format chosen with --format:
+ *
+ *  text    x^2 - 2xy + y^2, like we always did.
+ *  jsonl   one object per term and line: {"coeff":-2,"powers":{"x":1,"y":1}}
+ *  csv     a header with the variables and coeff, then one row per term.
+ *  latex   x^{2} - 2xy + y^{2}, in math mode.
+ *
+ * In a batch the terms of jsonl and csv also tells the line of the
+ * expression they are from, and with --range the power, the others have one
+ * line per expression or power.
+ *
+ * The sinks writes into a buffer of their own, that is written out when it
+ * is full, and when the sink is closed, the size of it is from the estimate
+ * of the output, so a small expansion doesn't need a big buffer.
+ *
+ * The workers of a parallel expansion writes their rows into parts from
+ * sink_part() instead, that just grows their buffer, and the parts are
+ * joined into the sink in the order of the rows. Within --max-memory the
+ * parts may be spooled to temporary files instead, and read back when they
+ * are joined.
+ *
+ * A shard of --shard is a sink that starts after the terms of the shards
+ * before it, and ends without the end of the output, unless it is the last.
+ *
+ * A sink with a big output to a file, has a writer thread, so the
+ * expansion doesn't wait for the writes, to a slow pipe or file system,
+ * and the writes doesn't wait for the expansion: a full buffer goes to a
+ * ring of SINK_RING buffers, that the writer empties with write(), and the
+ * sink goes on with the next buffer of the ring, it only waits when they
+ * are all full.
+ *
+ * The sink of --stats writes nothing, the terms goes to the stats of
+ * stats.c, the kernels hands them over as numbers with sink_term_long() and
+ * sink_term_big(), and the parts has stats of their own.
+ */
+
+#define SINK_MIN_BUF 4096
+#define SINK_MAX_BUF ( 1 << 20 )
+#define SINK_SPOOL_BUF ( 1 << 16 ) /* of a part that is spooled */
+#define SINK_RING 4             /* buffers of the writer thread */
+#define SINK_WRITER_MIN ( 4.0 * SINK_MAX_BUF ) /* output that has a writer thread */
+
+struct sinkWriter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      /* there is a full buffer to write, or done */
+    pthread_cond_t emptied;     /* a buffer has been written */
+    int fd;
+    char *bufs[SINK_RING];
+    size_t lens[SINK_RING];
+    int head, nr_full;          /* the next buffer to write, and how many */
+    bool done;
+};
+
+/* Writes the full buffers of the ring in order, until the sink is closed. */
+static void *writer_thread( void *arg )
+{
+    sinkWriter *w = arg;
+
+    pthread_mutex_lock( &w->lock );
+    for ( ;; ) {
+        while ( w->nr_full == 0 && !w->done )
+            pthread_cond_wait( &w->filled, &w->lock );
+        if ( w->nr_full == 0 )
+            break;
+        char *buf = w->bufs[w->head];
+        size_t len = w->lens[w->head];
+        pthread_mutex_unlock( &w->lock );
+        while ( len > 0 ) {
+            ssize_t n = write( w->fd, buf, len );
+            if ( n == -1 && errno == EINTR )
+                continue;
+            if ( n == -1 ) {
+                perror( "sink: write" );
+                exit( EXIT_FAILURE );
+            }
+            buf += n;
+            len -= n;
+        }
+        pthread_mutex_lock( &w->lock );
+        w->head = ( w->head + 1 ) % SINK_RING;
+        w->nr_full--;
+        pthread_cond_signal( &w->emptied );
+    }
+    pthread_mutex_unlock( &w->lock );
+    return NULL;
+}
+
+/* Starts the writer of out, the buffer of out becomes the first of the
+ * ring. What is buffered in the FILE, goes before. */
+static void writer_start( termSink *out )
+{
+    sinkWriter *w = malloc( sizeof( sinkWriter ) );
+    if ( w == NULL ) {
+        expand_fail( "sink_open: Out of memory\n" );
+    }
+    w->bufs[0] = out->buf;
+    for ( int b = 1; b < SINK_RING; b++ ) {
+        if ( ( w->bufs[b] = malloc( out->cap ) ) == NULL ) {
+            expand_fail( "sink_open: Out of memory\n" );
+        }
+    }
+    w->fd = fileno( out->fp );
+    w->head = 0;
+    w->nr_full = 0;
+    w->done = false;
+    pthread_mutex_init( &w->lock, NULL );
+    pthread_cond_init( &w->filled, NULL );
+    pthread_cond_init( &w->emptied, NULL );
+    fflush( out->fp );
+    if ( pthread_create( &w->thread, NULL, writer_thread, w ) != 0 ) {
+        fprintf( stderr, "sink_open: Can't start the writer thread, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
+    out->writer = w;
+}
+
+/* Hands the buffer of out to the writer, and takes the next one of the
+ * ring, when it has been written. */
+static void writer_push( termSink *out )
+{
+    sinkWriter *w = out->writer;
+
+    pthread_mutex_lock( &w->lock );
+    int tail = ( w->head + w->nr_full ) % SINK_RING;
+    w->lens[tail] = out->len;
+    w->nr_full++;
+    pthread_cond_signal( &w->filled );
+    while ( w->nr_full == SINK_RING )
+        pthread_cond_wait( &w->emptied, &w->lock );
+    out->buf = w->bufs[( tail + 1 ) % SINK_RING];
+    pthread_mutex_unlock( &w->lock );
+    out->len = 0;
+}
+
+/* Waits for the writer to write the rest, and frees it, out->buf too. */
+static void writer_stop( termSink *out )
+{
+    sinkWriter *w = out->writer;
+
+    pthread_mutex_lock( &w->lock );
+    w->done = true;
+    pthread_cond_signal( &w->filled );
+    pthread_mutex_unlock( &w->lock );
+    pthread_join( w->thread, NULL );
+    pthread_cond_destroy( &w->emptied );
+    pthread_cond_destroy( &w->filled );
+    pthread_mutex_destroy( &w->lock );
+    for ( int b = 0; b < SINK_RING; b++ )
+        free( w->bufs[b] );
+    free( w );
+    out->writer = NULL;
+    out->buf = NULL;
+}
+
+static void sink_flush( termSink *out )
+{
+    if ( out->writer != NULL ) {
+        if ( out->len > 0 )
+            writer_push( out );
+        return;
+    }
+    if ( out->len > 0 && fwrite( out->buf, 1, out->len, out->fp ) != out->len ) {
+        perror( "sink: write" );
+        exit( EXIT_FAILURE );
+    }
+    out->len = 0;
+}
+
+static void sink_write( termSink *out, const char *str, size_t len )
+{
+    out->bytes += len;
+    if ( out->writer != NULL ) {
+       /* Through the buffers of the ring, whatever the size. */
+        while ( out->len + len > out->cap ) {
+            size_t room = out->cap - out->len;
+            memcpy( out->buf + out->len, str, room );
+            out->len += room;
+            str += room;
+            len -= room;
+            sink_flush( out );
+        }
+    } else if ( out->len + len > out->cap && out->fp == NULL ) {
+       /* A part, that is kept until it is joined. */
+        while ( out->len + len > out->cap )
+            out->cap *= 2;
+        out->buf = realloc( out->buf, out->cap );
+        if ( out->buf == NULL ) {
+            expand_fail( "sink_write: Out of memory\n" );
+        }
+    } else if ( out->len + len > out->cap ) {
+        sink_flush( out );
+        if ( len > out->cap ) {
+           /* Doesn't fit at all, like the digits of a huge coeffecient. */
+            if ( fwrite( str, 1, len, out->fp ) != len ) {
+                perror( "sink: write" );
+                exit( EXIT_FAILURE );
+            }
+            return;
+        }
+    }
+    memcpy( out->buf + out->len, str, len );
+    out->len += len;
+}
+
+static void sink_puts( termSink *out, const char *str )
+{
+    sink_write( out, str, strlen( str ) );
+}
+
+static void sink_char( termSink *out, char c )
+{
+    sink_write( out, &c, 1 );
+}
+
+static void sink_int( termSink *out, long val )
+{
+    char digits[24];
+    int len = snprintf( digits, sizeof( digits ), "%ld", val );
+    sink_write( out, digits, len );
+}
+
+/* Writes the digits of a coeffecient with the decimal point put back in
+ * place, from the right, scale digits in, without any trailing zeroes among
+ * the decimals.
+ * example:
+ *      digits == "1250", scale == 4 gives 0.125
+ */
+static void sink_coeff( termSink *out, bool neg, const char *digits, int scale )
+{
+    int len = strlen( digits );
+    while ( scale > 0 && len > 1 && digits[len - 1] == '0' ) {
+        len--;
+        scale--;
+    }
+    if ( len == 1 && digits[0] == '0' )
+        scale = 0; /* 0, whatever the decimals */
+    if ( neg )
+        sink_char( out, '-' );
+    if ( scale == 0 ) {
+        sink_write( out, digits, len );
+    } else if ( len > scale ) {
+        sink_write( out, digits, len - scale );
+        sink_char( out, '.' );
+        sink_write( out, digits + len - scale, scale );
+    } else {
+        sink_puts( out, "0." );
+        for ( int i = len; i < scale; i++ )
+            sink_char( out, '0' );
+        sink_write( out, digits, len );
+    }
+}
+
+/* The sign as an operator in front of the term, unless it is the first. */
+static void sink_operator( termSink *out, bool neg )
+{
+    if ( out->nr_terms == 0 ) {
+        if ( neg )
+            sink_char( out, '-' );
+    } else {
+        sink_puts( out, neg ? " - " : " + " );
+    }
+}
+
+/* text: 2xy^3 */
+static void text_term( termSink *out, bool neg, const char *digits, int scale, const int *exps )
+{
+    bool has_vars = false;
+    for ( int i = 0; i < out->nr_vars; i++ )
+        has_vars = has_vars || exps[i] > 0;
+
+    sink_operator( out, neg );
+    sink_coeff( out, false, digits, scale );
+   /* The exponent of an approximate coeffecient, 1.2e+1, doesn't run into
+    * the variables, one of them may be an e. */
+    if ( APPROX_MODE && has_vars )
+        sink_char( out, ' ' );
+    for ( int i = 0; i < out->nr_vars; i++ ) {
+        if ( exps[i] > 0 )
+            sink_char( out, out->vartable[i] );
+        if ( exps[i] > 1 ) {
+            sink_char( out, '^' );
+            sink_int( out, exps[i] );
+        }
+    }
+}
+
+static void text_end( termSink *out )
+{
+    sink_puts( out, ( out->nr_terms == 0 ) ? "0\n" : "\n" );
+}
+
+/* jsonl: {"coeff":2,"powers":{"x":1,"y":3}} */
+static void jsonl_term( termSink *out, bool neg, const char *digits, int scale, const int *exps )
+{
+    sink_char( out, '{' );
+    if ( out->line > 0 ) {
+        sink_puts( out, "\"line\":" );
+        sink_int( out, out->line );
+        sink_char( out, ',' );
+    }
+    if ( out->power > 0 ) {
+        sink_puts( out, "\"power\":" );
+        sink_int( out, out->power );
+        sink_char( out, ',' );
+    }
+    sink_puts( out, "\"coeff\":" );
+    sink_coeff( out, neg, digits, scale );
+    sink_puts( out, ",\"powers\":{" );
+    for ( int i = 0; i < out->nr_vars; i++ ) {
+        if ( i > 0 )
+            sink_char( out, ',' );
+        sink_char( out, '"' );
+        sink_char( out, out->vartable[i] );
+        sink_puts( out, "\":" );
+        sink_int( out, exps[i] );
+    }
+    sink_puts( out, "}}\n" );
+}
+
+/* csv: x,y,coeff then 1,3,2 */
+static void csv_begin( termSink *out )
+{
+    if ( out->line > 0 )
+        sink_puts( out, "line," );
+    if ( out->power > 0 )
+        sink_puts( out, "power," );
+    for ( int i = 0; i < out->nr_vars; i++ ) {
+        sink_char( out, out->vartable[i] );
+        sink_char( out, ',' );
+    }
+    sink_puts( out, "coeff\n" );
+}
+
+static void csv_term( termSink *out, bool neg, const char *digits, int scale, const int *exps )
+{
+    if ( out->line > 0 ) {
+        sink_int( out, out->line );
+        sink_char( out, ',' );
+    }
+    if ( out->power > 0 ) {
+        sink_int( out, out->power );
+        sink_char( out, ',' );
+    }
+    for ( int i = 0; i < out->nr_vars; i++ ) {
+        sink_int( out, exps[i] );
+        sink_char( out, ',' );
+    }
+    sink_coeff( out, neg, digits, scale );
+    sink_char( out, '\n' );
+}
+
+/* Is the coeffecient 1, once the decimal point is in place? */
+static bool is_one( const char *digits, int scale )
+{
+    int len = strlen( digits );
+    while ( scale > 0 && len > 1 && digits[len - 1] == '0' ) {
+        len--;
+        scale--;
+    }
+    return scale == 0 && len == 1 && digits[0] == '1';
+}
+
+/* latex: 2xy^{3}, where a coeffecient of 1 is left out, like we would
+ * write it. */
+static void latex_begin( termSink *out )
+{
+    sink_char( out, '$' );
+}
+
+static void latex_term( termSink *out, bool neg, const char *digits, int scale, const int *exps )
+{
+    bool has_vars = false;
+    for ( int i = 0; i < out->nr_vars; i++ )
+        has_vars = has_vars || exps[i] > 0;
+
+    sink_operator( out, neg );
+    if ( !has_vars || !is_one( digits, scale ) ) {
+        sink_coeff( out, false, digits, scale );
+        if ( APPROX_MODE && has_vars )
+            sink_puts( out, "\\," );
+    }
+    for ( int i = 0; i < out->nr_vars; i++ ) {
+        if ( exps[i] > 0 )
+            sink_char( out, out->vartable[i] );
+        if ( exps[i] > 1 ) {
+            sink_puts( out, "^{" );
+            sink_int( out, exps[i] );
+            sink_char( out, '}' );
+        }
+    }
+}
+
+static void latex_end( termSink *out )
+{
+    sink_puts( out, ( out->nr_terms == 0 ) ? "0$\n" : "$\n" );
+}
+
+static const sinkOps sink_ops[] = {
+    [FMT_TEXT] = { "text", NULL, text_term, text_end },
+    [FMT_JSONL] = { "jsonl", NULL, jsonl_term, NULL },
+    [FMT_CSV] = { "csv", csv_begin, csv_term, NULL },
+    [FMT_LATEX] = { "latex", latex_begin, latex_term, latex_end },
+};
+
+/* The format with the name, or -1 if there isn't one. */
+int sink_format( const char *name )
+{
+    for ( size_t f = 0; f < sizeof( sink_ops ) / sizeof( sink_ops[0] ); f++ )
+        if ( strcmp( sink_ops[f].name, name ) == 0 )
+            return ( int ) f;
+    return -1;
+}
+
+/* A sink without the beginning of the output written. */
+static termSink *sink_new( out_format fmt, FILE *fp, int nr_vars, char *vartable, double size_hint,
+                           long line )
+{
+    termSink *out = malloc( sizeof( termSink ) );
+    if ( out == NULL ) {
+        expand_fail( "sink_open: Out of memory\n" );
+    }
+    out->ops = &sink_ops[fmt];
+    out->fp = fp;
+    out->nr_vars = nr_vars;
+    out->vartable = vartable;
+    out->nr_terms = 0;
+    out->line = line;
+    out->power = 0;
+    out->spool = false;
+    out->bytes = 0;
+    out->ends = true;
+    out->stats = NULL;
+    out->writer = NULL;
+    out->len = 0;
+    out->cap = ( size_hint < SINK_MIN_BUF ) ? SINK_MIN_BUF
+        : ( size_hint > SINK_MAX_BUF ) ? SINK_MAX_BUF : ( size_t ) size_hint;
+    out->buf = malloc( out->cap );
+    if ( out->buf == NULL ) {
+        expand_fail( "sink_open: Out of memory\n" );
+    }
+   /* Not for the memory streams of a batch, they have no file. */
+    if ( size_hint >= SINK_WRITER_MIN && fileno( fp ) >= 0 )
+        writer_start( out );
+    return out;
+}
+
+/**
+ * @brief Opens a sink that writes the terms to fp, in format fmt.
+ * @detail size_hint is about how many bytes the output takes, from
+ * estimate_expansion(), it sizes the buffer. line is the line of the
+ * expression in a batch, or 0.
+ */
+termSink *sink_open( out_format fmt, FILE *fp, int nr_vars, char *vartable, double size_hint,
+                     long line )
+{
+    termSink *out = sink_new( fmt, fp, nr_vars, vartable, size_hint, line );
+    if ( out->ops->begin != NULL )
+        out->ops->begin( out );
+    return out;
+}
+
+/**
+ * @brief Opens a sink for shard of nr_shards of the output, with the terms
+ * from number first on.
+ * @detail Only the first shard begins the output, like with the header of
+ * csv, and only the last one ends it, so the shards put together, in order,
+ * is the same output as without them.
+ */
+termSink *sink_shard( out_format fmt, FILE *fp, int nr_vars, char *vartable, double size_hint,
+                      int shard, int nr_shards, long first )
+{
+    termSink *out = sink_new( fmt, fp, nr_vars, vartable, size_hint, 0 );
+    if ( shard == 0 && out->ops->begin != NULL )
+        out->ops->begin( out );
+    out->nr_terms = first;
+    out->ends = ( shard == nr_shards - 1 );
+    return out;
+}
+
+/**
+ * @brief Opens a sink for the terms of (...)^power, of --range.
+ * @detail A header, a beginning without an end, like the one of csv, is
+ * only written by the first power, like by the first shard, so that the
+ * powers together are one csv, with the power in a column. A format with
+ * an end, like latex, has a formula per power.
+ */
+termSink *sink_power( out_format fmt, FILE *fp, int nr_vars, char *vartable, double size_hint,
+                      int power )
+{
+    termSink *out = sink_new( fmt, fp, nr_vars, vartable, size_hint, 0 );
+    out->power = power;
+    if ( out->ops->begin != NULL && ( power == 1 || out->ops->end != NULL ) )
+        out->ops->begin( out );
+    return out;
+}
+
+/* A sink that adds the terms up in stats, and doesn't write anything. */
+termSink *sink_stats( FILE *fp, int nr_vars, termStats *stats )
+{
+    termSink *out = sink_new( FMT_TEXT, fp, nr_vars, NULL, 0.0, 0 );
+    out->stats = stats;
+    out->ends = false;
+    return out;
+}
+
+/* One term, digits is the magnitude of the coeffecient, with scale
+ * decimals. */
+void sink_term( termSink *out, bool neg, const char *digits, int scale, const int *exps )
+{
+    if ( out->stats != NULL )
+        stats_digits( out->stats, neg, digits, scale );
+    else
+        out->ops->term( out, neg, digits, scale, exps );
+    out->nr_terms++;
+}
+
+void sink_term_long( termSink *out, long coeff, int scale, const int *exps )
+{
+    if ( out->stats != NULL ) {
+        stats_long( out->stats, coeff, scale );
+        out->nr_terms++;
+        return;
+    }
+    char digits[24];
+    snprintf( digits, sizeof( digits ), "%lu", ( coeff < 0 ) ? -( unsigned long ) coeff : ( unsigned long ) coeff );
+    sink_term( out, coeff < 0, digits, scale, exps );
+}
+
+void sink_term_big( termSink *out, const bigNum *coeff, int scale, const int *exps )
+{
+    if ( out->stats != NULL ) {
+        stats_big( out->stats, coeff, scale );
+        out->nr_terms++;
+        return;
+    }
+    char *digits = big_to_digits( coeff );
+    sink_term( out, coeff->neg && !big_is_zero( coeff ), digits, scale, exps );
+    free( digits );
+}
+
+/* Ends the output, writes out what is left in the buffer, and frees the
+ * sink. */
+void sink_close( termSink *out )
+{
+    if ( out->ends && out->ops->end != NULL )
+        out->ops->end( out );
+    TRACE( output_done, out->nr_terms, out->bytes );
+    sink_flush( out );
+    if ( out->writer != NULL )
+        writer_stop( out );
+    fflush( out->fp );
+    free( out->buf );
+    free( out );
+}
+
+/**
+ * @brief A part of the output to out, for the terms from number first on,
+ * that is kept in memory until it is joined with sink_join().
+ */
+termSink *sink_part( termSink *out, long first )
+{
+    termSink *part = malloc( sizeof( termSink ) );
+    if ( part == NULL ) {
+        fprintf( stderr, "sink_part: Out of memory, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
+   /* Just what doesn't change while the workers runs, the rest of out is
+    * written by the worker that joins its part. */
+    part->ops = out->ops;
+    part->nr_vars = out->nr_vars;
+    part->vartable = out->vartable;
+    part->line = out->line;
+    part->power = out->power;
+    part->spool = out->spool;
+    part->ends = out->ends;
+    part->stats = NULL;
+    part->bytes = 0;
+    part->fp = NULL;
+    part->writer = NULL;
+    if ( out->spool && ( part->fp = tmpfile(  ) ) == NULL ) {
+        perror( "sink_part: tmpfile" );
+        exit( EXIT_FAILURE );
+    }
+    part->nr_terms = first;
+    if ( out->stats != NULL )
+        part->stats = stats_new( out->stats->max_scale );
+    part->len = 0;
+    part->cap = out->spool ? SINK_SPOOL_BUF : SINK_MIN_BUF;
+    part->buf = malloc( part->cap );
+    if ( part->buf == NULL ) {
+        fprintf( stderr, "sink_part: Out of memory, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
+    return part;
+}
+
+/* Writes the part to out, after the terms before it, and frees it. */
+void sink_join( termSink *out, termSink *part )
+{
+    if ( part->fp != NULL ) {
+       /* Spooled, the buffer of the part is reused to read it back. */
+        size_t len;
+        sink_flush( part );
+        rewind( part->fp );
+        while ( ( len = fread( part->buf, 1, part->cap, part->fp ) ) > 0 )
+            sink_write( out, part->buf, len );
+        if ( ferror( part->fp ) ) {
+            perror( "sink_join: read" );
+            exit( EXIT_FAILURE );
+        }
+        fclose( part->fp );
+        part->len = 0;
+    }
+    sink_write( out, part->buf, part->len );
+    if ( part->stats != NULL ) {
+        stats_merge( out->stats, part->stats );
+        stats_free( part->stats );
+    }
+    out->nr_terms = part->nr_terms;
+    free( part->buf );
+    free( part );
+}
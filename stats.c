@@ -0,0 +1,323 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "multinom.h"
+/*
+ * stats.c
+ * =======
+ *
+ * --stats: instead of printing the terms, the sink adds them up here, the
+ * number of terms, of the negative ones and of zeroes, the sum of the
+ * coeffecients, the biggest and smallest nonzero |coeffecient|, and how
+ * many coeffecients there are of every bit length, of the integer part
+ * when they have decimals. The kernels hands the coeffecients over as
+ * longs or bignums, so nothing is formatted.
+ *
+ * The sum is checked against (c1 + c2 + ... + ck)^n, that it must be, by
+ * the multinomial theorem, when there are no bounds.
+ *
+ * Every part of a parallel expansion has stats of its own, that are merged
+ * when the part is joined with the sink, like the text of the parts.
+ *
+ * The coeffecients of the terms has different numbers of decimals, when
+ * the coeffecients of the variables has decimals, so the sum is kept per
+ * number of decimals, and put together at the end, and the biggest and
+ * smallest are compared with the decimals lined up.
+ */
+
+#define STATS_ROWS 32   /* lines of the histogram, at the most */
+
+/**
+ * @brief New stats for terms with at most max_scale decimals.
+ */
+termStats *stats_new( int max_scale )
+{
+    termStats *st = calloc( 1, sizeof( termStats ) );
+    if ( st == NULL || ( st->sums = malloc( ( max_scale + 1 ) * sizeof( bigNum ) ) ) == NULL ) {
+        expand_fail( "stats_new: Out of memory\n" );
+    }
+    st->max_scale = max_scale;
+    for ( int s = 0; s <= max_scale; s++ )
+        big_init( &st->sums[s] );
+    big_init( &st->max );
+    big_init( &st->min );
+    big_init( &st->tmp );
+    big_init( &st->val );
+    return st;
+}
+
+void stats_free( termStats *st )
+{
+    for ( int s = 0; s <= st->max_scale; s++ )
+        big_free( &st->sums[s] );
+    big_free( &st->max );
+    big_free( &st->min );
+    big_free( &st->tmp );
+    big_free( &st->val );
+    free( st->sums );
+    free( st->bits );
+    free( st );
+}
+
+/* The bits of |b|, 0 for 0. */
+static int big_bits( const bigNum *b )
+{
+    if ( b->len == 0 )
+        return 0;
+    int bits = ( b->len - 1 ) * 32;
+    for ( uint32_t top = b->limb[b->len - 1]; top != 0; top >>= 1 )
+        bits++;
+    return bits;
+}
+
+/* The bits of the integer part of |b| / 10^scale, with tmp for the
+ * division. */
+static int int_bits( const bigNum *b, int scale, bigNum *tmp )
+{
+    uint32_t div = 1;
+
+    if ( scale == 0 )
+        return big_bits( b );
+    big_copy( tmp, b );
+    for ( ; scale >= 9; scale -= 9 )
+        big_div_small( tmp, 1000000000U );
+    while ( scale-- > 0 )
+        div *= 10;
+    big_div_small( tmp, div );
+    return big_bits( tmp );
+}
+
+/* Compares |a| / 10^sa with |b| / 10^sb, with tmp for lining up the
+ * decimals. */
+static int cmp_scaled( const bigNum *a, int sa, const bigNum *b, int sb, bigNum *tmp )
+{
+    if ( sa == sb )
+        return big_cmp_mag( a, b );
+    big_copy( tmp, ( sa < sb ) ? a : b );
+    for ( int s = ( sa < sb ) ? sa : sb; s < ( ( sa < sb ) ? sb : sa ); s++ )
+        big_mul_small( tmp, 10 );
+    return ( sa < sb ) ? big_cmp_mag( tmp, b ) : big_cmp_mag( a, tmp );
+}
+
+static void count_bits( termStats *st, int bits )
+{
+    if ( bits >= st->nr_bits ) {
+        int nr_bits = ( bits + 1 > 2 * st->nr_bits ) ? bits + 1 : 2 * st->nr_bits;
+        st->bits = realloc( st->bits, nr_bits * sizeof( long ) );
+        if ( st->bits == NULL ) {
+            expand_fail( "stats: Out of memory\n" );
+        }
+        memset( st->bits + st->nr_bits, 0, ( nr_bits - st->nr_bits ) * sizeof( long ) );
+        st->nr_bits = nr_bits;
+    }
+    st->bits[bits]++;
+}
+
+/* A nonzero magnitude for the biggest and smallest, with scale decimals. */
+static void track_extremes( termStats *st, const bigNum *mag, int scale )
+{
+    if ( st->nonzero == 0 || cmp_scaled( mag, scale, &st->max, st->max_sc, &st->tmp ) > 0 ) {
+        big_copy( &st->max, mag );
+        st->max.neg = false;
+        st->max_sc = scale;
+    }
+    if ( st->nonzero == 0 || cmp_scaled( mag, scale, &st->min, st->min_sc, &st->tmp ) < 0 ) {
+        big_copy( &st->min, mag );
+        st->min.neg = false;
+        st->min_sc = scale;
+    }
+    st->nonzero++;
+}
+
+/* One coeffecient, with scale decimals. */
+void stats_big( termStats *st, const bigNum *coeff, int scale )
+{
+    st->terms++;
+    count_bits( st, int_bits( coeff, scale, &st->tmp ) );
+    if ( big_is_zero( coeff ) )
+        return;
+    st->negative += coeff->neg;
+    big_add( &st->sums[scale], coeff );
+    track_extremes( st, coeff, scale );
+}
+
+void stats_long( termStats *st, long coeff, int scale )
+{
+    bigNum *val = &st->val;
+    big_set( val, coeff );
+    stats_big( st, val, scale );
+}
+
+/* One coeffecient as the digits of a sink_term(), from the engines that
+ * doesn't go through the kernels. */
+void stats_digits( termStats *st, bool neg, const char *digits, int scale )
+{
+    bigNum *val = &st->val;
+    big_set( val, 0L );
+    for ( const char *d = digits; *d != '\0'; d++ ) {
+        big_mul_small( val, 10 );
+        big_set( &st->tmp, *d - '0' );
+        big_add( val, &st->tmp );
+    }
+    val->neg = neg && !big_is_zero( val );
+    stats_big( st, val, scale );
+}
+
+/* Adds the stats of part to st, the terms of part are after the ones in st. */
+void stats_merge( termStats *st, const termStats *part )
+{
+    for ( int s = 0; s <= st->max_scale; s++ )
+        big_add( &st->sums[s], &part->sums[s] );
+    for ( int b = 0; b < part->nr_bits; b++ ) {
+        if ( part->bits[b] > 0 ) {
+            count_bits( st, b );
+            st->bits[b] += part->bits[b] - 1;
+        }
+    }
+    if ( part->nonzero > 0 ) {
+        long nonzero = st->nonzero;
+        track_extremes( st, &part->max, part->max_sc );
+        track_extremes( st, &part->min, part->min_sc );
+        st->nonzero = nonzero + part->nonzero;
+    }
+    st->terms += part->terms;
+    st->negative += part->negative;
+}
+
+/* b with scale decimals, like the sink writes them, long numbers just by
+ * their number of digits. */
+static void print_scaled( FILE *fp, const char *label, const bigNum *b, int scale )
+{
+    char *digits = big_to_digits( b );
+    int len = ( int ) strlen( digits );
+
+    while ( scale > 0 && len > 1 && digits[len - 1] == '0' ) {
+        digits[--len] = '\0';
+        scale--;
+    }
+    if ( len == 1 && digits[0] == '0' )
+        scale = 0; /* 0, like the sink writes it */
+    fprintf( fp, "%-15s%s", label, ( b->neg && !big_is_zero( b ) ) ? "-" : "" );
+    if ( len > 60 ) {
+        fprintf( fp, "%.1s.%.9se%+d, %d digits\n", digits, digits + 1, len - 1 - scale, len );
+    } else if ( scale == 0 ) {
+        fprintf( fp, "%s\n", digits );
+    } else if ( len > scale ) {
+        fprintf( fp, "%.*s.%s\n", len - scale, digits, digits + len - scale );
+    } else {
+        fprintf( fp, "0." );
+        for ( int i = len; i < scale; i++ )
+            fputc( '0', fp );
+        fprintf( fp, "%s\n", digits );
+    }
+    free( digits );
+}
+
+/**
+ * @brief Prints the stats of the expansion of (c1x1 + c2x2 + ...)^n, and
+ * checks the sum, if check is true.
+ * @detail The coefftbl must have been adjusted for the operators with
+ * adjust_coeffs(). line is the line in a batch, or 0. Returns 0, or -1 if
+ * the sum isn't what it should be.
+ */
+int stats_print( termStats *st, FILE *fp, int nr_vars, int exponent, int *coefftbl, int *scaletbl,
+                 bool check, long line )
+{
+    int ret_val = 0;
+    bigNum sum, expected, base, power;
+
+    big_init( &sum );
+    big_init( &expected );
+    big_init( &base );
+    big_init( &power );
+
+   /* The sum, with all the decimals, max_scale of them. */
+    for ( int s = 0; s <= st->max_scale; s++ ) {
+        if ( s > 0 )
+            big_mul_small( &sum, 10 );
+        big_add( &sum, &st->sums[s] );
+    }
+    if ( line > 0 )
+        fprintf( fp, "%-15s%ld\n", "line:", line );
+    fprintf( fp, "%-15s%ld\n", "terms:", st->terms );
+    fprintf( fp, "%-15s%ld\n", "negative:", st->negative );
+    fprintf( fp, "%-15s%ld\n", "zero:", st->terms - st->nonzero );
+    print_scaled( fp, "sum:", &sum, st->max_scale );
+
+    if ( check ) {
+       /* (c1 + c2 + ... + ck)^n, with the decimals of the ci lined up, the
+        * max_scale of the stats is n times as many. */
+        int max_sc = 0;
+        for ( int v = 0; v < nr_vars; v++ )
+            max_sc = ( scaletbl[v] > max_sc ) ? scaletbl[v] : max_sc;
+        for ( int v = 0; v < nr_vars; v++ ) {
+            big_set( &power, coefftbl[v] );
+            for ( int s = scaletbl[v]; s < max_sc; s++ )
+                big_mul_small( &power, 10 );
+            big_add( &base, &power );
+        }
+        big_set( &expected, 1L );
+        for ( int e = 0; e < exponent; e++ ) {
+            big_mul( &power, &expected, &base );
+            big_copy( &expected, &power );
+        }
+        bool same = big_cmp_mag( &sum, &expected ) == 0
+            && ( big_is_zero( &sum ) || sum.neg == expected.neg );
+        fprintf( fp, "%-15s%s\n", "", same ? "== (c1 + c2 + ...)^n, checked" : "!= (c1 + c2 + ...)^n" );
+        if ( !same ) {
+            if ( line > 0 )
+                fprintf( stderr, "line %ld: ", line );
+            fprintf( stderr, "stats: The sum of the coeffecients isn't (c1 + c2 + ...)^%d.\n", exponent );
+            ret_val = -1;
+        }
+    }
+    if ( st->nonzero > 0 ) {
+        print_scaled( fp, "max |coeff|:", &st->max, st->max_sc );
+        print_scaled( fp, "min |coeff|:", &st->min, st->min_sc );
+    }
+
+   /* The bit lengths, in at most STATS_ROWS even ranges. */
+    int top = st->nr_bits - 1;
+    while ( top > 0 && st->bits[top] == 0 )
+        top--;
+    int width = top / STATS_ROWS + 1;
+    fprintf( fp, "bits:\n" );
+    for ( int lo = 0; lo <= top; lo += width ) {
+        long count = 0;
+        for ( int b = lo; b < lo + width && b <= top; b++ )
+            count += st->bits[b];
+        if ( width == 1 )
+            fprintf( fp, "  %-13d%ld\n", lo, count );
+        else
+            fprintf( fp, "  %6d-%-6d%ld\n", lo, lo + width - 1, count );
+    }
+    fflush( fp );
+    big_free( &power );
+    big_free( &base );
+    big_free( &expected );
+    big_free( &sum );
+    return ret_val;
+}
@@ -23,15 +23,28 @@
  * GNU LPGL 3.0
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include "multinom.h"
+
+THREAD_LOCAL jmp_buf *PARSE_ERR_JMP = NULL;
+THREAD_LOCAL jmp_buf *LINE_ERR_JMP = NULL;
+THREAD_LOCAL long PARSE_LINENO = 0;
+
 /*
  * Uses the global variables `consumed_text` and  `ignored_spaces`
  * for pinpointing out exactly where the error is. This obviously doesn't
  * work to well with a proportional font!
+ * The batch mode has many threads that may fail at once, so we lock stderr
+ * for the whole message.
  */
 void syntax_err( const char *const details )
 {
     fflush( stdout );
+    flockfile( stderr );
+    if ( PARSE_LINENO > 0 ) {
+        fprintf( stderr, "line %ld:\n", PARSE_LINENO );
+    }
     if (NO_PREPROC == false) {
         fprintf(stderr,"%s\n",argstr);
     }
@@ -41,14 +54,51 @@ void syntax_err( const char *const details )
     } else {
         fprintf( stderr, "%*sSyntax error: %s\n", ( consumed_text + ignored_spaces ), " ", details );
     }
+    funlockfile( stderr );
 }
 
 void syntax_err2( const char *const details1, const char *const details2 )
 {
     fflush( stdout );
+    flockfile( stderr );
+    if ( PARSE_LINENO > 0 ) {
+        fprintf( stderr, "line %ld:\n", PARSE_LINENO );
+    }
     if (NO_PREPROC == false) {
         fprintf(stderr,"%s\n",argstr);
     }
     fprintf( stderr, "\n%*s^\n", ( consumed_text + ignored_spaces ), " " );
     fprintf( stderr, "%*sSyntax error: %s: %s\n", ( consumed_text + ignored_spaces ), " ", details1, details2 );
+    funlockfile( stderr );
+}
+
+/* Gives up on the expression after a syntax error: the batch mode goes on
+ * with the next one, otherwise we exit. */
+void parse_fail( void )
+{
+    if ( PARSE_ERR_JMP != NULL ) {
+        longjmp( *PARSE_ERR_JMP, 1 );
+    }
+    exit( EXIT_FAILURE );
+}
+
+/* Reports an error in the expansion of an expression, like running out of
+ * memory, or an overflow, and gives up on it: in a batch the error has the
+ * number of the line, and we go on with the next line, otherwise we exit. */
+void expand_fail( const char *format, ... )
+{
+    va_list args;
+
+    flockfile( stderr );
+    if ( LINE_ERR_JMP != NULL && PARSE_LINENO > 0 ) {
+        fprintf( stderr, "line %ld: ", PARSE_LINENO );
+    }
+    va_start( args, format );
+    vfprintf( stderr, format, args );
+    va_end( args );
+    funlockfile( stderr );
+    if ( LINE_ERR_JMP != NULL ) {
+        longjmp( *LINE_ERR_JMP, 1 );
+    }
+    exit( EXIT_FAILURE );
 }
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include "multinom.h"
+/*
+ * termindex.c
+ * ===========
+ *
+ * Random access to the terms of an expansion, by their row in the terms
+ * table that mk_permtable() makes, without making it: ti_unrank() gives the
+ * powers of the term in a row, and ti_rank() the row of a term.
+ *
+ * The rows are the compositions of n into k parts, part i at most bound i,
+ * in decreasing lexical order. ways[i][r] is how many ways the positions
+ * i..k-1 can add up to r, and below[i][r] is ways[i][0] + .. + ways[i][r-1].
+ * With part i == v, and r left for the positions i..k-1, the rows before
+ * it are those where part i is bigger than v, that is every way the
+ * positions after it can add up to r-v-1 or less, down to what the bound
+ * of part i leaves: a difference of two below[i+1], so a rank takes O(k)
+ * steps, and an unrank O(k log n), with a binary search for every part.
+ * The tables take O((k+1) * (n+2)) longs.
+ */
+
+#define WAYS( ti, i, r ) ( ( ti )->ways[( i ) * ( ( ti )->n + 1 ) + ( r )] )
+#define BELOW( ti, i, r ) ( ( ti )->below[( i ) * ( ( ti )->n + 2 ) + ( r )] )
+
+static void *ti_alloc( size_t size )
+{
+    void *p = calloc( 1, size );
+    if ( p == NULL ) {
+        expand_fail( "term index: Out of memory\n" );
+    }
+    return p;
+}
+
+/**
+ * @brief Counts the rows of an expansion to the power of n, with k
+ * variables, whose powers are at most bounds, or anything if it is NULL.
+ * @detail Returns false if any count is too big for a long.
+ */
+bool ti_init( termIndex *ti, int k, int n, const int *bounds )
+{
+    ti->k = k;
+    ti->n = n;
+    ti->bounds = ti_alloc( k * sizeof( int ) );
+    ti->ways = ti_alloc( ( k + 1 ) * ( n + 1 ) * sizeof( long ) );
+    ti->below = ti_alloc( ( k + 1 ) * ( n + 2 ) * sizeof( long ) );
+    for ( int i = 0; i < k; i++ )
+        ti->bounds[i] = ( bounds != NULL && bounds[i] < n ) ? bounds[i] : n;
+
+    WAYS( ti, k, 0 ) = 1;
+    for ( int i = k; i >= 0; i-- ) {
+        if ( i < k ) {
+            for ( int r = 0; r <= n; r++ ) {
+                int lowest = ( r - ti->bounds[i] > 0 ) ? r - ti->bounds[i] : 0;
+                WAYS( ti, i, r ) = BELOW( ti, i + 1, r + 1 ) - BELOW( ti, i + 1, lowest );
+            }
+        }
+        for ( int r = 0; r <= n; r++ ) {
+            if ( BELOW( ti, i, r ) > LONG_MAX - WAYS( ti, i, r ) ) {
+                ti_free( ti );
+                return false;
+            }
+            BELOW( ti, i, r + 1 ) = BELOW( ti, i, r ) + WAYS( ti, i, r );
+        }
+    }
+    return true;
+}
+
+void ti_free( termIndex *ti )
+{
+    free( ti->below );
+    free( ti->bounds );
+    free( ti->ways );
+}
+
+/* The number of terms, rows in the table. */
+long ti_count( const termIndex *ti )
+{
+    return WAYS( ti, 0, ti->n );
+}
+
+/* The rows before a term whose part i is v, among those with rest left for
+ * the positions i..k-1, where the part is bigger than v. */
+static long rows_above( const termIndex *ti, int i, int rest, int v )
+{
+    int highest = ( rest < ti->bounds[i] ) ? rest : ti->bounds[i];
+    return BELOW( ti, i + 1, rest - v ) - BELOW( ti, i + 1, rest - highest );
+}
+
+/**
+ * @brief The row of the term with the powers exps, counting from 0.
+ * @detail Returns -1 if it isn't a term of the expansion: the powers
+ * doesn't add up to n, or they are out of bounds.
+ */
+long ti_rank( const termIndex *ti, const int *exps )
+{
+    long row = 0;
+    int rest = ti->n;
+
+    for ( int i = 0; i < ti->k; i++ ) {
+        if ( exps[i] < 0 || exps[i] > ti->bounds[i] || exps[i] > rest )
+            return -1;
+        row += rows_above( ti, i, rest, exps[i] );
+        rest -= exps[i];
+    }
+    return ( rest == 0 ) ? row : -1;
+}
+
+/**
+ * @brief Sets exps to the powers of the term in row, that must be less than
+ * ti_count().
+ * @detail Part i is the smallest v, that has no more than row rows above
+ * it, and row counts on from there.
+ */
+void ti_unrank( const termIndex *ti, long row, int *exps )
+{
+    int rest = ti->n;
+
+    for ( int i = 0; i < ti->k; i++ ) {
+        int lo = 0,
+            hi = ( rest < ti->bounds[i] ) ? rest : ti->bounds[i];
+        while ( lo < hi ) {
+            int mid = lo + ( hi - lo ) / 2;
+            if ( rows_above( ti, i, rest, mid ) <= row )
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        exps[i] = lo;
+        row -= rows_above( ti, i, rest, lo );
+        rest -= lo;
+    }
+}
+
+/**
+ * @brief The coeffecient of one term, with the powers exps, into res.
+ * @detail The multinomial coeffecient, by exact binomial steps, or from the
+ * primes of primefact.c for a big n, times the powers of the coeffecients,
+ * that must have been adjusted with adjust_coeffs().
+ */
+void term_coeff( int nr_vars, int exponent, const int *exps, int *coefftbl, bigNum *res )
+{
+    if ( exponent >= PF_MIN_EXPONENT ) {
+        primeTerm pt;
+        pf_init( &pt, nr_vars, exponent, coefftbl );
+        pf_move_to( &pt, exps );
+        pf_value( &pt, res );
+        pf_free( &pt );
+        return;
+    }
+    int left = exponent;
+    big_set( res, 1L );
+    for ( int v = 0; v < nr_vars; v++ ) {
+        for ( int m = 1; m <= exps[v]; m++ ) {
+            big_mul_small( res, left - m + 1 );
+            big_div_small( res, m );
+        }
+        left -= exps[v];
+        for ( int e = 0; e < exps[v]; e++ )
+            big_mul_small( res, coefftbl[v] );
+    }
+}
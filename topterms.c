@@ -0,0 +1,262 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "multinom.h"
+/*
+ * topterms.c
+ * ==========
+ *
+ * Finds the K terms with the largest absolute coeffecients, without making
+ * the terms table.
+ *
+ * We walk the compositions depth first, in the same order as mk_permtable()
+ * makes them, and keep the K best terms so far in a heap with the smallest
+ * of them on top. The coeffecient of a term is
+ *
+ *      n! * |c1|^e1/e1! * |c2|^e2/e2! * ... * |ck|^ek/ek!
+ *
+ * and when the first i powers are chosen, with r of the exponent left for
+ * the rest of the variables, then the product of the rest is no bigger than
+ * the sum of all their products, which by the multinomial theorem is
+ * (|c_i+1| + ... + |ck|)^r / r!. If that bound, can't beat the smallest term
+ * in a full heap, then we skip the whole subtree. The bound is computed with
+ * logarithms, so it doesn't overflow, the terms are computed exactly.
+ */
+
+#define TOP_MARGIN 1e-9     /* slack for rounding in the logarithms */
+
+typedef struct {
+    long coeff;             /* without the decimal point */
+    int scale;              /* number of decimals */
+    double magn;            /* |coeff| / 10^scale, for comparing scales */
+    long order;             /* place in the expansion, for equal terms */
+    int *exps;
+} topTerm;
+
+typedef struct {
+    int nr_vars, exponent;
+    int *coefftbl, *scaletbl;
+    int *lim, *room;        /* bounds, and what the suffix can take */
+    double *log_abs;        /* log|c_i| */
+    double *log_suffix;     /* log(|c_i| + ... + |ck|) */
+    int *exps;              /* the composition we are building */
+    topTerm *heap;
+    int top_k, heap_len;
+    long visited;
+} topState;
+
+/* e * log(base) with 0 * log(0) == 0 */
+static double log_pow( double log_base, int e )
+{
+    return ( e == 0 ) ? 0.0 : e * log_base;
+}
+
+/* Is a a bigger term than b? equal terms are ordered by where they are in
+ * the expansion. */
+static bool better( topTerm *a, topTerm *b )
+{
+    if ( a->scale == b->scale && labs( a->coeff ) != labs( b->coeff ) ) {
+        return labs( a->coeff ) > labs( b->coeff );
+    } else if ( a->scale != b->scale && a->magn != b->magn ) {
+        return a->magn > b->magn;
+    }
+    return a->order < b->order;
+}
+
+static void swap_terms( topTerm *a, topTerm *b )
+{
+    topTerm tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Restores the heap from i downwards, the worst term is on top. */
+static void sift_down( topTerm *heap, int len, int i )
+{
+    for ( ;; ) {
+        int worst = i,
+            l = 2 * i + 1,
+            r = 2 * i + 2;
+        if ( l < len && better( &heap[worst], &heap[l] ) )
+            worst = l;
+        if ( r < len && better( &heap[worst], &heap[r] ) )
+            worst = r;
+        if ( worst == i )
+            return;
+        swap_terms( &heap[i], &heap[worst] );
+        i = worst;
+    }
+}
+
+static void sift_up( topTerm *heap, int i )
+{
+    while ( i > 0 && better( &heap[( i - 1 ) / 2], &heap[i] ) ) {
+        swap_terms( &heap[i], &heap[( i - 1 ) / 2] );
+        i = ( i - 1 ) / 2;
+    }
+}
+
+/* The exact coeffecient of the composition in st->exps. */
+static long exact_coeff( topState *st, int *scale )
+{
+    *scale = 0;
+    for ( int i = 0; i < st->nr_vars; i++ )
+        *scale += st->scaletbl[i] * st->exps[i];
+    return l_term_coeff( st->nr_vars, st->exponent, st->exps, st->coefftbl );
+}
+
+static void offer_term( topState *st )
+{
+    topTerm cand;
+
+    cand.coeff = exact_coeff( st, &cand.scale );
+    cand.magn = fabs( ( double ) cand.coeff ) / pow( 10.0, cand.scale );
+    cand.order = st->visited++;
+
+    if ( st->heap_len < st->top_k ) {
+        topTerm *slot = &st->heap[st->heap_len];
+        cand.exps = slot->exps;
+        *slot = cand;
+        memcpy( slot->exps, st->exps, st->nr_vars * sizeof( int ) );
+        sift_up( st->heap, st->heap_len++ );
+    } else if ( better( &cand, &st->heap[0] ) ) {
+        cand.exps = st->heap[0].exps;
+        st->heap[0] = cand;
+        memcpy( st->heap[0].exps, st->exps, st->nr_vars * sizeof( int ) );
+        sift_down( st->heap, st->heap_len, 0 );
+    }
+}
+
+/* Chooses the power of variable i, with rest of the exponent left, log_prefix
+ * is the logarithm of n! * |c1|^e1/e1! * ... for the powers chosen so far. */
+static void top_walk( topState *st, int i, int rest, double log_prefix )
+{
+    if ( i == st->nr_vars - 1 ) {
+        st->exps[i] = rest;
+        offer_term( st );
+        return;
+    }
+    int highest = ( rest < st->lim[i] ) ? rest : st->lim[i];
+    int lowest = ( rest - st->room[i + 1] > 0 ) ? rest - st->room[i + 1] : 0;
+
+    for ( int e = highest; e >= lowest; e-- ) {
+        double log_cur = log_prefix + log_pow( st->log_abs[i], e ) - lgamma( e + 1.0 );
+        if ( st->heap_len == st->top_k ) {
+            double log_bound = log_cur + log_pow( st->log_suffix[i + 1], rest - e ) - lgamma( rest - e + 1.0 );
+            if ( log_bound + TOP_MARGIN < log( st->heap[0].magn ) )
+                continue; /* nothing in there can make it into the heap */
+        }
+        st->exps[i] = e;
+        top_walk( st, i + 1, rest - e, log_cur );
+    }
+}
+
+/* The memory top_terms() needs, with a heap of top_k terms, of an
+ * expansion with nr_terms terms, the heap never has more. */
+double top_terms_memory( int top_k, int nr_vars, double nr_terms )
+{
+    if ( top_k > nr_terms )
+        top_k = ( int ) nr_terms;
+    return ( double ) nr_vars * ( 3 * sizeof( int ) + 2 * sizeof( double ) ) + sizeof( int ) + sizeof( double )
+        + ( double ) top_k * ( sizeof( topTerm ) + nr_vars * sizeof( int ) );
+}
+
+/**
+ * @brief Writes the top_k terms with the largest absolute coeffecients,
+ * biggest first, to out.
+ * @detail
+ * The coefftbl must have been adjusted for the operators with
+ * adjust_coeffs() first, bounds is the same as for mk_permtable().
+ * Memory is O(top_k * nr_vars), no terms table is made.
+ */
+void top_terms( int top_k, int nr_vars, int exponent, int *bounds, int *coefftbl, int *scaletbl,
+                termSink *out )
+{
+    topState st;
+    termIndex ti;
+
+   /* The heap is never bigger than the terms, that --top 2000000000 of
+    * (a + b)^2 fits in. */
+    if ( ti_init( &ti, nr_vars, exponent, bounds ) ) {
+        if ( ti_count( &ti ) < top_k )
+            top_k = ( ti_count( &ti ) > 0 ) ? ( int ) ti_count( &ti ) : 1;
+        ti_free( &ti );
+    }
+    st.nr_vars = nr_vars;
+    st.exponent = exponent;
+    st.coefftbl = coefftbl;
+    st.scaletbl = scaletbl;
+    st.top_k = top_k;
+    st.heap_len = 0;
+    st.visited = 0;
+    st.lim = malloc( nr_vars * sizeof( int ) );
+    st.room = calloc( nr_vars + 1, sizeof( int ) );
+    st.log_abs = malloc( nr_vars * sizeof( double ) );
+    st.log_suffix = malloc( ( nr_vars + 1 ) * sizeof( double ) );
+    st.exps = malloc( nr_vars * sizeof( int ) );
+    st.heap = malloc( top_k * sizeof( topTerm ) );
+    int *heap_exps = malloc( ( size_t ) top_k * nr_vars * sizeof( int ) );
+    if ( st.lim == NULL || st.room == NULL || st.log_abs == NULL || st.log_suffix == NULL
+         || st.exps == NULL || st.heap == NULL || heap_exps == NULL ) {
+        expand_fail( "top_terms: Out of memory\n" );
+    }
+    for ( int j = 0; j < top_k; j++ )
+        st.heap[j].exps = heap_exps + ( size_t ) j * nr_vars;
+
+    double suffix = 0.0;
+    st.log_suffix[nr_vars] = -HUGE_VAL;
+    for ( int i = nr_vars - 1; i >= 0; i-- ) {
+        double abs_coeff = fabs( ( double ) coefftbl[i] ) / pow( 10.0, scaletbl[i] );
+        st.lim[i] = ( bounds != NULL && bounds[i] < exponent ) ? bounds[i] : exponent;
+        st.room[i] = ( st.room[i + 1] + st.lim[i] < exponent ) ? st.room[i + 1] + st.lim[i] : exponent;
+        st.log_abs[i] = log( abs_coeff );
+        suffix += abs_coeff;
+        st.log_suffix[i] = log( suffix );
+    }
+
+    if ( st.room[0] == exponent ) {
+        top_walk( &st, 0, exponent, lgamma( exponent + 1.0 ) );
+    }
+
+   /* Empty the heap from the back, that puts the biggest term first. */
+    int nr_terms = st.heap_len;
+    while ( st.heap_len > 1 ) {
+        swap_terms( &st.heap[0], &st.heap[st.heap_len - 1] );
+        sift_down( st.heap, --st.heap_len, 0 );
+    }
+    for ( int j = 0; j < nr_terms; j++ ) {
+        sink_term_long( out, st.heap[j].coeff, st.heap[j].scale, st.heap[j].exps );
+    }
+
+    free( heap_exps );
+    free( st.heap );
+    free( st.exps );
+    free( st.log_suffix );
+    free( st.log_abs );
+    free( st.room );
+    free( st.lim );
+}
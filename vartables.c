@@ -25,13 +25,16 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <limits.h>
 #include "multinom.h"
 /**
  * Transfers data from nodeTable into more suitable tables related to the termstable
  * so that we can expand the terms into something meaningful.
  * returns: the exponent.
  */
-int make_vartables( int nritems, itemData ** nodeTable, int nrvars, int nrops, char **vars, int **coeffs, char **ops )
+int make_vartables( int nritems, itemData ** nodeTable, int nrvars, int nrops, char **vars, int **coeffs,
+                    int **scales, char **ops )
 {
     int vars_c = 0,
         op_c = 0,
@@ -47,6 +50,11 @@ int make_vartables( int nritems, itemData ** nodeTable, int nrvars, int nrops, c
         fprintf( stderr, "coeffs: Out of memory, exiting\n" );
         exit( EXIT_FAILURE );
     }
+    *scales = malloc( nrvars * sizeof( int ) );
+    if ( *scales == NULL ) {
+        fprintf( stderr, "scales: Out of memory, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
     *ops = malloc( nrops );
 
     if ( *ops == NULL ) {
@@ -58,6 +66,7 @@ int make_vartables( int nritems, itemData ** nodeTable, int nrvars, int nrops, c
         switch ( nodeTable[i]->type ) {
         case typeFact:
             ( *vars )[vars_c] = ( nodeTable[i] )->factor.var;
+            ( *scales )[vars_c] = ( nodeTable[i] )->factor.scale;
             ( *coeffs )[vars_c++] = ( nodeTable[i] )->factor.coeff;
             break;
         case typeOpr:
@@ -74,9 +83,93 @@ int make_vartables( int nritems, itemData ** nodeTable, int nrvars, int nrops, c
     return exponent;
 }
 
-void free_vartables( char **vars, int **coeffs, char **ops )
+void free_vartables( char **vars, int **coeffs, int **scales, char **ops )
 {
     free( *vars );
     free( *coeffs );
+    free( *scales );
     free( *ops );
 }
+
+/* Reads the number of a bound, and advances spec past it. */
+static int read_bound( const char **spec )
+{
+    long val = 0;
+    if ( !isdigit( ( unsigned char ) **spec ) )
+        return -1;
+    while ( isdigit( ( unsigned char ) **spec ) ) {
+        val = val * 10 + ( *( *spec )++ - '0' );
+        if ( val > INT_MAX )
+            return -1;
+    }
+    return ( int ) val;
+}
+
+/* Reads a list like "x=2,y=3" into a table parallel to vars, a variable
+ * that isn't in the list gets dflt. opt and what names the option and the
+ * values in the errors. */
+static int *read_var_list( const char *spec, int nrvars, char *vars, int dflt, const char *opt,
+                           const char *what )
+{
+    int *vals = malloc( nrvars * sizeof( int ) );
+    if ( vals == NULL ) {
+        expand_fail( "%s: Out of memory\n", opt );
+    }
+    const char *p = spec;
+    for ( int i = 0; i < nrvars; i++ )
+        vals[i] = dflt;
+    while ( *p != '\0' ) {
+        char var = *p++;
+        int i = 0;
+        while ( i < nrvars && vars[i] != var )
+            i++;
+        if ( !isalpha( ( unsigned char ) var ) || i == nrvars ) {
+            expand_fail( "%s: \"%c\" isn't a variable in the expression\n", opt, var );
+        }
+        if ( *p++ != '=' || ( vals[i] = read_bound( &p ) ) == -1 || ( *p != ',' && *p != '\0' ) ) {
+            expand_fail( "%s: Bad %s for %c: \"%s\"\n", opt, what, var, spec );
+        }
+        if ( *p == ',' )
+            p++;
+    }
+    return vals;
+}
+
+/**
+ * Makes a table with the maximum power of every variable, parallel to vars,
+ * from the argument of -b, which is either a list like "x=2,y=3", or a
+ * single number that applies to every variable. A variable that isn't in
+ * the list, gets INT_MAX as its bound, which means no bound at all.
+ * returns: NULL if spec is NULL, the table otherwise.
+ */
+int *make_bounds( const char *spec, int nrvars, char *vars )
+{
+    if ( spec == NULL )
+        return NULL;
+
+    const char *p = spec;
+    if ( isdigit( ( unsigned char ) *p ) ) {
+        int *bounds = malloc( nrvars * sizeof( int ) );
+        if ( bounds == NULL ) {
+            expand_fail( "bounds: Out of memory\n" );
+        }
+        int bound = read_bound( &p );
+        if ( bound == -1 || *p != '\0' ) {
+            expand_fail( "-b: Bad bound: \"%s\"\n", spec );
+        }
+        for ( int i = 0; i < nrvars; i++ )
+            bounds[i] = bound;
+        return bounds;
+    }
+    return read_var_list( spec, nrvars, vars, INT_MAX, "-b", "bound" );
+}
+
+/**
+ * Makes a table with the powers of a term, parallel to vars, from the
+ * argument of --index, a list like "x=2,y=3", a variable that isn't in the
+ * list has the power 0.
+ */
+int *make_powers( const char *spec, int nrvars, char *vars )
+{
+    return read_var_list( spec, nrvars, vars, 0, "--index", "power" );
+}
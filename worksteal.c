@@ -0,0 +1,286 @@
+/**
+ * Copyright (c) 2024 Tommy Bollman <tommy.bollman@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * GNU LPGL 3.0
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "multinom.h"
+/*
+ * worksteal.c
+ * ===========
+ *
+ * A work stealing scheduler for the big expansions, where the rows of the
+ * terms table are the items. The work doesn't divide evenly by the powers
+ * of the first variable: the subtree where it is 0 is far bigger than the
+ * one where it is n, and a big coeffecient takes longer than a small one.
+ *
+ * So every worker has a deque of ranges of rows. A worker takes the last
+ * range it pushed, and splits it in halves, pushing the upper halves, until
+ * what is left is no bigger than the grain, then it calls the leaf function
+ * for that. A worker without any ranges of its own steals the first range
+ * of another worker, that is the biggest it has, and splits that in turn.
+ * Every worker starts with a state of its own from the init function.
+ *
+ * A leaf may leave a part, like the text of its terms, the parts are given
+ * to the emit function in the order of the rows, by whatever worker
+ * finishes the part that is next in turn, so the output streams out while
+ * the rest are expanded. The parts that are done before their turn waits
+ * in a list.
+ *
+ * The deques are small, a worker has at most one range per halving, and
+ * the leaves are big, so they share one mutex.
+ */
+
+#define WS_DEQUE 64             /* ranges in a deque, one per halving */
+#define WS_MIN_ITEMS 16384      /* items, before it is worth the threads */
+#define WS_LEAVES 32            /* leaves per worker, that the grain aims at */
+#define WS_MIN_GRAIN 256
+
+typedef struct {
+    long lo, hi;
+} wsRange;
+
+typedef struct {
+    wsRange range[WS_DEQUE];
+    int top, bottom;            /* steal at the top, push and pop at the bottom */
+} wsDeque;
+
+/* A part that waits for its turn. */
+typedef struct wsPart {
+    long lo, hi;
+    void *part;
+    struct wsPart *next;
+} wsPart;
+
+typedef struct {
+    const wsOps *ops;
+    void *ctx;
+    long nr_items, grain;
+    int nr_workers;
+    wsDeque *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* there is a range to steal, or no more */
+    long items_done;
+    int idle;                   /* workers waiting for work */
+    long next_lo;               /* the part that is to be emitted next */
+    wsPart *parked;             /* sorted by lo */
+    bool emitting;
+} wsPool;
+
+typedef struct {
+    wsPool *pool;
+    int id;
+} wsWorker;
+
+static void ws_push( wsDeque *dq, long lo, long hi )
+{
+    if ( dq->bottom == WS_DEQUE ) {
+        memmove( dq->range, dq->range + dq->top, ( dq->bottom - dq->top ) * sizeof( wsRange ) );
+        dq->bottom -= dq->top;
+        dq->top = 0;
+    }
+    if ( dq->bottom == WS_DEQUE ) {
+        fprintf( stderr, "ws_push: Can't happen, the deque is full.\n" );
+        exit( EXIT_FAILURE );
+    }
+    dq->range[dq->bottom].lo = lo;
+    dq->range[dq->bottom++].hi = hi;
+}
+
+static bool ws_pop( wsDeque *dq, wsRange *r )
+{
+    if ( dq->top == dq->bottom )
+        return false;
+    *r = dq->range[--dq->bottom];
+    if ( dq->top == dq->bottom )
+        dq->top = dq->bottom = 0;
+    return true;
+}
+
+/* Steals the biggest range of the first worker after id that has any. */
+static bool ws_steal( wsPool *pool, int id, wsRange *r )
+{
+    for ( int i = 1; i < pool->nr_workers; i++ ) {
+        wsDeque *dq = &pool->deques[( id + i ) % pool->nr_workers];
+        if ( dq->top < dq->bottom ) {
+            *r = dq->range[dq->top++];
+            if ( dq->top == dq->bottom )
+                dq->top = dq->bottom = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Parks the part of a leaf, and emits what is in turn, unless another
+ * worker is at it already, then that one does. Called with the lock. */
+static void ws_commit( wsPool *pool, long lo, long hi, void *part )
+{
+    wsPart *p = malloc( sizeof( wsPart ) ),
+        **pp = &pool->parked;
+    if ( p == NULL ) {
+        fprintf( stderr, "ws_commit: Out of memory, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
+    p->lo = lo;
+    p->hi = hi;
+    p->part = part;
+    while ( *pp != NULL && ( *pp )->lo < lo )
+        pp = &( *pp )->next;
+    p->next = *pp;
+    *pp = p;
+    pool->items_done += hi - lo;
+
+    if ( !pool->emitting ) {
+        pool->emitting = true;
+        while ( pool->parked != NULL && pool->parked->lo == pool->next_lo ) {
+            p = pool->parked;
+            pool->parked = p->next;
+            pool->next_lo = p->hi;
+            pthread_mutex_unlock( &pool->lock );
+            if ( pool->ops->emit != NULL )
+                pool->ops->emit( pool->ctx, p->part );
+            free( p );
+            pthread_mutex_lock( &pool->lock );
+        }
+        pool->emitting = false;
+    }
+    if ( pool->items_done == pool->nr_items )
+        pthread_cond_broadcast( &pool->work );
+}
+
+static void *ws_worker( void *arg )
+{
+    wsWorker *w = arg;
+    wsPool *pool = w->pool;
+    wsDeque *own = &pool->deques[w->id];
+    void *local = ( pool->ops->init != NULL ) ? pool->ops->init( pool->ctx ) : NULL;
+    wsRange r;
+
+    pthread_mutex_lock( &pool->lock );
+    for ( ;; ) {
+        if ( !ws_pop( own, &r ) && !ws_steal( pool, w->id, &r ) ) {
+            if ( pool->items_done == pool->nr_items )
+                break;
+            pool->idle++;
+            pthread_cond_wait( &pool->work, &pool->lock );
+            pool->idle--;
+            continue;
+        }
+        while ( r.hi - r.lo > pool->grain ) {
+            long mid = r.lo + ( r.hi - r.lo ) / 2;
+            ws_push( own, mid, r.hi );
+            r.hi = mid;
+            if ( pool->idle > 0 )
+                pthread_cond_signal( &pool->work );
+        }
+        pthread_mutex_unlock( &pool->lock );
+
+        void *part = NULL;
+        pool->ops->leaf( pool->ctx, local, r.lo, r.hi, &part );
+
+        pthread_mutex_lock( &pool->lock );
+        ws_commit( pool, r.lo, r.hi, part );
+    }
+    pthread_mutex_unlock( &pool->lock );
+    if ( pool->ops->fini != NULL )
+        pool->ops->fini( pool->ctx, local );
+    return NULL;
+}
+
+/**
+ * @brief The number of threads to expand nr_items rows with.
+ * @detail One, when there are too few to be worth it, and in the batch
+ * mode, where every expression has a thread already, otherwise -j, or one
+ * per cpu.
+ */
+int ws_threads( double nr_items )
+{
+    if ( BATCH_MODE || nr_items < WS_MIN_ITEMS )
+        return 1;
+    if ( NR_JOBS > 0 )
+        return NR_JOBS;
+    long nr_cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    return ( nr_cpus > 1 ) ? ( int ) nr_cpus : 1;
+}
+
+/* A grain that gives every worker about WS_LEAVES leaves. */
+long ws_grain( long nr_items, int nr_threads )
+{
+    long grain = nr_items / ( ( long ) nr_threads * WS_LEAVES );
+    return ( grain < WS_MIN_GRAIN ) ? WS_MIN_GRAIN : grain;
+}
+
+/**
+ * @brief Runs the leaf function of ops over the items 0..nr_items-1, in
+ * ranges of at most grain items, on nr_threads workers, this thread being
+ * one of them.
+ * @detail The parts of the leaves are emitted in order, before we return.
+ */
+void ws_run( long nr_items, long grain, int nr_threads, const wsOps *ops, void *ctx )
+{
+    wsPool pool;
+    pthread_t *threads = malloc( nr_threads * sizeof( pthread_t ) );
+    wsWorker *workers = malloc( nr_threads * sizeof( wsWorker ) );
+
+    pool.deques = calloc( nr_threads, sizeof( wsDeque ) );
+    if ( threads == NULL || workers == NULL || pool.deques == NULL ) {
+        fprintf( stderr, "ws_run: Out of memory, exiting\n" );
+        exit( EXIT_FAILURE );
+    }
+    pool.ops = ops;
+    pool.ctx = ctx;
+    pool.nr_items = nr_items;
+    pool.grain = ( grain > 0 ) ? grain : 1;
+    pool.nr_workers = nr_threads;
+    pool.items_done = 0;
+    pool.idle = 0;
+    pool.next_lo = 0;
+    pool.parked = NULL;
+    pool.emitting = false;
+    pthread_mutex_init( &pool.lock, NULL );
+    pthread_cond_init( &pool.work, NULL );
+    ws_push( &pool.deques[0], 0, nr_items );
+
+    for ( int t = 0; t < nr_threads; t++ ) {
+        workers[t].pool = &pool;
+        workers[t].id = t;
+    }
+    for ( int t = 1; t < nr_threads; t++ ) {
+        if ( pthread_create( &threads[t], NULL, ws_worker, &workers[t] ) != 0 ) {
+            fprintf( stderr, "ws_run: Can't start the worker threads, exiting\n" );
+            exit( EXIT_FAILURE );
+        }
+    }
+    ws_worker( &workers[0] );
+    for ( int t = 1; t < nr_threads; t++ )
+        pthread_join( threads[t], NULL );
+
+    pthread_cond_destroy( &pool.work );
+    pthread_mutex_destroy( &pool.lock );
+    free( pool.deques );
+    free( workers );
+    free( threads );
+}